@@ -0,0 +1,74 @@
+#include "AllocationCounter.hpp"
+
+#ifdef PN_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+namespace Utils
+{
+	static void *AlignedAllocate(std::size_t size, const std::size_t &alignment)
+	{
+#ifdef _WIN32
+		return _aligned_malloc(size ? size : 1, alignment);
+#else
+		// aligned_alloc wants the size to be a multiple of the alignment
+		size = size ? (size + alignment - 1) / alignment * alignment : alignment;
+		return std::aligned_alloc(alignment, size);
+#endif
+	}
+
+	static void AlignedFree(void *memory)
+	{
+#ifdef _WIN32
+		_aligned_free(memory);
+#else
+		std::free(memory);
+#endif
+	}
+}
+
+// Replacing the global operator new and delete also covers new[], nothrow new and sized delete,
+// their default versions forward to these
+void *operator new(std::size_t size)
+{
+	AllocationCounter::Increment();
+
+	void *memory = std::malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+// Over-aligned types go through their own overloads, which the default ones cannot free
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	AllocationCounter::Increment();
+
+	void *memory = Utils::AlignedAllocate(size, (std::size_t)alignment);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept
+{
+	Utils::AlignedFree(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept
+{
+	Utils::AlignedFree(memory);
+}
+
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts the heap allocations made through operator new on the calling thread, so code that is meant to run
+// without allocating can be checked by comparing the count before and after it. Only builds that define
+// PN_COUNT_ALLOCATIONS replace operator new, the count stays 0 everywhere else.
+class AllocationCounter
+{
+public:
+	static uint64_t GetThreadCount() { return s_ThreadCount; }
+	static void Increment() { s_ThreadCount++; }
+
+private:
+	static inline thread_local uint64_t s_ThreadCount = 0;
+};
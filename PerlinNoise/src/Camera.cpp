@@ -1,14 +1,30 @@
 #include "Camera.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#ifndef PN_HEADLESS
 #include "Walnut/Input/Input.h"
 
-// Code obtained from https://github.com/TheCherno
-
 using namespace Walnut;
+#endif
+
+#if !defined(PN_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define PN_CAMERA_SIMD
+#endif
+
+namespace Utils
+{
+	// Rows of ray directions filled by one task
+	constexpr uint32_t RayRowsPerTask = 16;
+}
+
+// Code obtained from https://github.com/TheCherno
 
 Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	: m_VerticalFOV(verticalFOV), m_NearClip(nearClip), m_FarClip(farClip)
@@ -20,6 +36,7 @@ Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	RecalculateRayDirections();
 }
 
+#ifndef PN_HEADLESS
 bool Camera::OnUpdate(float ts)
 {
 	glm::vec2 mousePos = Input::GetMousePosition();
@@ -92,6 +109,7 @@ bool Camera::OnUpdate(float ts)
 
 	return moved;
 }
+#endif
 
 void Camera::OnResize(uint32_t width, uint32_t height)
 {
@@ -105,6 +123,24 @@ void Camera::OnResize(uint32_t width, uint32_t height)
 	RecalculateRayDirections();
 }
 
+void Camera::SetPose(const glm::vec3 &position, const glm::vec3 &direction)
+{
+	m_Position = position;
+	m_ForwardDirection = glm::normalize(direction);
+
+	RecalculateView();
+	RecalculateRayDirections();
+}
+
+void Camera::SetCacheRayDirections(const bool &cache)
+{
+	if (cache == m_CacheRayDirections)
+		return;
+
+	m_CacheRayDirections = cache;
+	RecalculateRayDirections();
+}
+
 float Camera::GetRotationSpeed()
 {
 	return 0.4f;
@@ -124,18 +160,73 @@ void Camera::RecalculateView()
 
 void Camera::RecalculateRayDirections()
 {
-	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
+	m_Version++;
 
-	for (uint32_t y = 0; y < m_ViewportHeight; y++)
+	// Every pixel's target lies on the same plane in view space, so before normalising the directions are an affine
+	// function of the pixel coordinates and the view only rotates them. Three targets give the whole basis.
+	auto target = [this](const float &x, const float &y)
 	{
-		for (uint32_t x = 0; x < m_ViewportWidth; x++)
-		{
-			glm::vec2 coord = { (float)x / (float)m_ViewportWidth, (float)y / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			glm::vec3 rayDirection = glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-			m_RayDirections[x + y * m_ViewportWidth] = rayDirection;
-		}
+		glm::vec4 target = m_InverseProjection * glm::vec4(x, y, 1, 1);
+		return glm::vec3(m_InverseView * glm::vec4(glm::vec3(target) / target.w, 0)); // World space
+	};
+	m_RayBasis.Corner = target(-1.0f, -1.0f);
+	m_RayBasis.StepX = (target(1.0f, -1.0f) - m_RayBasis.Corner) / (float)std::max(m_ViewportWidth, 1u);
+	m_RayBasis.StepY = (target(-1.0f, 1.0f) - m_RayBasis.Corner) / (float)std::max(m_ViewportHeight, 1u);
+
+	if (!m_CacheRayDirections)
+	{
+		m_RayDirections.clear();
+		m_RayDirections.shrink_to_fit();
+		return;
 	}
+
+	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
+
+	// Rows are filled in blocks on the thread pool
+	uint32_t tasks = (m_ViewportHeight + Utils::RayRowsPerTask - 1) / Utils::RayRowsPerTask;
+	ThreadPool::Get().ParallelFor(tasks, [this](size_t task)
+		{
+			uint32_t first = (uint32_t)task * Utils::RayRowsPerTask;
+			uint32_t last = std::min(first + Utils::RayRowsPerTask, m_ViewportHeight);
+			for (uint32_t y = first; y < last; y++)
+			{
+				glm::vec3 *row = &m_RayDirections[(size_t)y * m_ViewportWidth];
+				uint32_t x = 0;
+
+#ifdef PN_CAMERA_SIMD
+				// 4 directions at a time, normalised the same way as glm::normalize
+				glm::vec3 start = m_RayBasis.Corner + (float)y * m_RayBasis.StepY;
+				__m128 startX = _mm_set1_ps(start.x), startY = _mm_set1_ps(start.y), startZ = _mm_set1_ps(start.z);
+				__m128 stepX = _mm_set1_ps(m_RayBasis.StepX.x), stepY = _mm_set1_ps(m_RayBasis.StepX.y), stepZ = _mm_set1_ps(m_RayBasis.StepX.z);
+				__m128 one = _mm_set1_ps(1.0f);
+
+				for (; x + 4 <= m_ViewportWidth; x += 4)
+				{
+					__m128 xs = _mm_setr_ps((float)x, (float)(x + 1), (float)(x + 2), (float)(x + 3));
+					__m128 dx = _mm_add_ps(startX, _mm_mul_ps(xs, stepX));
+					__m128 dy = _mm_add_ps(startY, _mm_mul_ps(xs, stepY));
+					__m128 dz = _mm_add_ps(startZ, _mm_mul_ps(xs, stepZ));
+
+					__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+					__m128 scale = _mm_div_ps(one, length);
+					dx = _mm_mul_ps(dx, scale);
+					dy = _mm_mul_ps(dy, scale);
+					dz = _mm_mul_ps(dz, scale);
+
+					// Back to one vec3 per pixel, the last one is stored on its own so the row's end is not overwritten
+					__m128 dw = _mm_setzero_ps();
+					_MM_TRANSPOSE4_PS(dx, dy, dz, dw);
+					_mm_storeu_ps(&row[x].x, dx);
+					_mm_storeu_ps(&row[x + 1].x, dy);
+					_mm_storeu_ps(&row[x + 2].x, dz);
+					alignas(16) float last[4];
+					_mm_store_ps(last, dw);
+					row[x + 3] = glm::vec3(last[0], last[1], last[2]);
+				}
+#endif
+
+				for (; x < m_ViewportWidth; x++)
+					row[x] = GetRayDirection(x, y);
+			}
+		});
 }
\ No newline at end of file
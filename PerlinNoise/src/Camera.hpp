@@ -7,12 +7,31 @@
 
 class Camera
 {
+public:
+	// Derives the world space direction through pixel (x, y)
+	struct RayBasis
+	{
+		glm::vec3 Corner{ 0.0f };
+		glm::vec3 StepX{ 0.0f };
+		glm::vec3 StepY{ 0.0f };
+
+		glm::vec3 Direction(const uint32_t &x, const uint32_t &y) const
+		{
+			return glm::normalize(Corner + (float)y * StepY + (float)x * StepX);
+		}
+	};
+
 public:
 	Camera(float verticalFOV, float nearClip, float farClip);
 
+#ifndef PN_HEADLESS
 	bool OnUpdate(float ts);
+#endif
 	void OnResize(uint32_t width, uint32_t height);
 
+	// Places the camera at a fixed position looking along direction
+	void SetPose(const glm::vec3 &position, const glm::vec3 &direction);
+
 	const glm::mat4& GetProjection() const { return m_Projection; }
 	const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
 	const glm::mat4& GetView() const { return m_View; }
@@ -21,7 +40,18 @@ public:
 	const glm::vec3& GetPosition() const { return m_Position; }
 	const glm::vec3& GetDirection() const { return m_ForwardDirection; }
 
+	// Empty while the ray directions are not cached, use GetRayDirection or the basis instead
 	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+	const RayBasis& GetRayBasis() const { return m_RayBasis; }
+	glm::vec3 GetRayDirection(const uint32_t &x, const uint32_t &y) const { return m_RayBasis.Direction(x, y); }
+
+	// Without the cache the renderer derives every direction from the basis, which skips filling and reading
+	// a direction per pixel each time the camera moves
+	bool GetCacheRayDirections() const { return m_CacheRayDirections; }
+	void SetCacheRayDirections(const bool &cache);
+
+	// Changes every time the ray directions are recalculated
+	uint64_t GetVersion() const { return m_Version; }
 
 	float GetRotationSpeed();
 
@@ -48,8 +78,12 @@ private:
 
 	// Cached ray directions
 	std::vector<glm::vec3> m_RayDirections;
+	RayBasis m_RayBasis;
+	bool m_CacheRayDirections = true;
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
+	uint64_t m_Version = 0;
+
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 };
\ No newline at end of file
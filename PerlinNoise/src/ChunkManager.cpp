@@ -0,0 +1,163 @@
+#include "ChunkManager.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void ChunkManager::SetParameters(const int &seed, const int &cellsize, const int &levels, const double &attenuation)
+{
+	if (m_Generator && m_Generator->GetSeed() == seed && m_Generator->GetCellSize() == cellsize &&
+		m_Generator->GetLevels() == levels && m_Generator->GetAttenuation() == attenuation)
+		return;
+
+	// The chunks only need the generator to sample noise, so it does not need any pixel data of its own
+	Clear();
+	m_Generator = std::make_shared<const PerlinNoiseGenerator>(seed, 1, 1, cellsize, levels, attenuation);
+}
+
+bool ChunkManager::Update(const glm::vec3 &position)
+{
+	bool changed = false;
+
+	glm::ivec2 center = glm::ivec2((int)floor(position.x / ChunkSize), (int)floor(position.z / ChunkSize));
+	if (!m_HasWindow || center != m_Center)
+	{
+		m_Center = center;
+		m_HasWindow = true;
+		changed = true;
+	}
+
+	// Move the finished chunks into the cache
+	std::vector<std::shared_ptr<const Chunk>> ready;
+	{
+		std::lock_guard<std::mutex> lock(m_Ready->Mutex);
+		ready.swap(m_Ready->Chunks);
+	}
+
+	for (auto &chunk : ready)
+	{
+		Key key = MakeKey(chunk->X, chunk->Z);
+		m_Pending.erase(key);
+
+		m_UseOrder.push_front(key);
+		m_Chunks[key] = { chunk, m_UseOrder.begin() };
+
+		// Only rebuild the scene for chunks that are still in view
+		if (InView(chunk->X, chunk->Z))
+			changed = true;
+	}
+
+	if (!m_Generator)
+		return changed;
+
+	// Request the missing chunks closest to the camera first
+	std::vector<glm::ivec2> missing;
+	for (int z = m_Center.y - m_ViewDistance; z < m_Center.y + m_ViewDistance; z++)
+	{
+		for (int x = m_Center.x - m_ViewDistance; x < m_Center.x + m_ViewDistance; x++)
+		{
+			Key key = MakeKey(x, z);
+			auto it = m_Chunks.find(key);
+			if (it != m_Chunks.end())
+				Touch(it->second);
+			else if (m_Pending.find(key) == m_Pending.end())
+				missing.push_back(glm::ivec2(x, z));
+		}
+	}
+
+	std::sort(missing.begin(), missing.end(), [this](const glm::ivec2 &a, const glm::ivec2 &b)
+		{
+			glm::ivec2 da = a - m_Center;
+			glm::ivec2 db = b - m_Center;
+			return da.x * da.x + da.y * da.y < db.x * db.x + db.y * db.y;
+		});
+
+	for (const auto &chunk : missing)
+		Request(chunk.x, chunk.y);
+
+	Evict();
+
+	return changed;
+}
+
+void ChunkManager::GetWindow(std::vector<double> &noise, size_t &width, size_t &height, glm::ivec2 &origin) const
+{
+	int chunks = 2 * m_ViewDistance;
+	width = (size_t)chunks * ChunkSize;
+	height = (size_t)chunks * ChunkSize;
+	origin = (m_Center - m_ViewDistance) * ChunkSize;
+
+	noise.assign(width * height, -1.0);
+
+	for (int cz = 0; cz < chunks; cz++)
+	{
+		for (int cx = 0; cx < chunks; cx++)
+		{
+			auto it = m_Chunks.find(MakeKey(m_Center.x - m_ViewDistance + cx, m_Center.y - m_ViewDistance + cz));
+			if (it == m_Chunks.end())
+				continue;
+
+			// Unpack the chunk row by row into its place in the window
+			const std::vector<uint16_t> &data = it->second.Data->Noise;
+			for (int j = 0; j < ChunkSize; j++)
+			{
+				double *row = &noise[(size_t)(cx * ChunkSize) + ((size_t)(cz * ChunkSize + j)) * width];
+				for (int i = 0; i < ChunkSize; i++)
+					row[i] = PerlinNoiseGenerator::DequantizeHeight(data[i + j * ChunkSize]);
+			}
+		}
+	}
+}
+
+void ChunkManager::Clear()
+{
+	m_Chunks.clear();
+	m_UseOrder.clear();
+	m_Pending.clear();
+	m_HasWindow = false;
+
+	// Anything still being generated will finish into the old queue and be discarded
+	m_Ready = std::make_shared<ReadyQueue>();
+}
+
+void ChunkManager::Request(const int &x, const int &z)
+{
+	m_Pending.insert(MakeKey(x, z));
+
+	ThreadPool::Get().Submit([generator = m_Generator, ready = m_Ready, x, z]()
+		{
+			auto chunk = std::make_shared<Chunk>();
+			chunk->X = x;
+			chunk->Z = z;
+			chunk->Noise.resize((size_t)ChunkSize * ChunkSize);
+			generator->SampleRegion(x * ChunkSize, z * ChunkSize, ChunkSize, ChunkSize, chunk->Noise.data(), ChunkSize);
+
+			std::lock_guard<std::mutex> lock(ready->Mutex);
+			ready->Chunks.push_back(chunk);
+		});
+}
+
+bool ChunkManager::InView(const int &x, const int &z) const
+{
+	return x >= m_Center.x - m_ViewDistance && x < m_Center.x + m_ViewDistance &&
+		z >= m_Center.y - m_ViewDistance && z < m_Center.y + m_ViewDistance;
+}
+
+void ChunkManager::Touch(Entry &entry)
+{
+	// Move the chunk to the front of the use order
+	m_UseOrder.splice(m_UseOrder.begin(), m_UseOrder, entry.Use);
+}
+
+void ChunkManager::Evict()
+{
+	// Chunks in view were just touched, so they are only evicted if the window alone is over budget
+	size_t inView = (size_t)(4 * m_ViewDistance * m_ViewDistance);
+
+	while (GetMemoryUsage() > m_MemoryBudget && m_Chunks.size() > inView)
+	{
+		Key key = m_UseOrder.back();
+		m_UseOrder.pop_back();
+		m_Chunks.erase(key);
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "PerlinNoise.hpp"
+
+// Streams fixed size chunks of noise around the camera. Chunks are generated in the background on the
+// shared thread pool and kept in a cache that evicts the least recently used chunks once it is over budget.
+// Every chunk samples the same unbounded noise function at its own coordinates, so neighbours line up exactly.
+class ChunkManager
+{
+public:
+	static constexpr int ChunkSize = 64;
+
+	// Heights are cached as 16-bit values, a quarter of the memory of the doubles the window is built from
+	struct Chunk
+	{
+		int X = 0;
+		int Z = 0;
+		std::vector<uint16_t> Noise;
+	};
+
+public:
+	ChunkManager() = default;
+
+	// Drops every cached chunk if the noise parameters changed
+	void SetParameters(const int &seed, const int &cellsize, const int &levels, const double &attenuation);
+
+	// Collects finished chunks and requests the ones around position, returns true if the window changed
+	bool Update(const glm::vec3 &position);
+
+	// Copies the window of chunks around the camera into noise, missing chunks are filled with -1
+	void GetWindow(std::vector<double> &noise, size_t &width, size_t &height, glm::ivec2 &origin) const;
+
+	void Clear();
+
+	int GetViewDistance() const { return m_ViewDistance; }
+	void SetViewDistance(const int &chunks) { m_ViewDistance = std::max(chunks, 1); }
+
+	size_t GetMemoryBudget() const { return m_MemoryBudget; }
+	void SetMemoryBudget(const size_t &bytes) { m_MemoryBudget = bytes; }
+
+	size_t GetChunkCount() const { return m_Chunks.size(); }
+	size_t GetPendingCount() const { return m_Pending.size(); }
+	size_t GetMemoryUsage() const { return m_Chunks.size() * ChunkBytes; }
+
+private:
+	using Key = uint64_t;
+
+	struct Entry
+	{
+		std::shared_ptr<const Chunk> Data;
+		std::list<Key>::iterator Use;
+	};
+
+	// Finished chunks are handed back through a queue shared with the background tasks. Changing the
+	// parameters swaps in a new queue, so chunks still being generated with the old ones are dropped.
+	struct ReadyQueue
+	{
+		std::mutex Mutex;
+		std::vector<std::shared_ptr<const Chunk>> Chunks;
+	};
+
+	static Key MakeKey(const int &x, const int &z) { return ((Key)(uint32_t)x << 32) | (Key)(uint32_t)z; }
+	static constexpr size_t ChunkBytes = sizeof(Chunk) + sizeof(uint16_t) * ChunkSize * ChunkSize;
+
+	// The window covers the 2 * ViewDistance chunks on each axis around the camera's chunk
+	bool InView(const int &x, const int &z) const;
+	void Request(const int &x, const int &z);
+	void Touch(Entry &entry);
+	void Evict();
+
+private:
+	std::shared_ptr<const PerlinNoiseGenerator> m_Generator;
+	std::shared_ptr<ReadyQueue> m_Ready = std::make_shared<ReadyQueue>();
+
+	// Most recently used chunks are at the front of the list
+	std::unordered_map<Key, Entry> m_Chunks;
+	std::list<Key> m_UseOrder;
+	std::unordered_set<Key> m_Pending;
+
+	glm::ivec2 m_Center{ 0, 0 };
+	bool m_HasWindow = false;
+	int m_ViewDistance = 2;
+	size_t m_MemoryBudget = 64ull * 1024 * 1024;
+};
@@ -0,0 +1,106 @@
+#include "HeightField.hpp"
+
+#include <algorithm>
+
+void HeightField::Generate(const std::vector<double> &noise, const size_t &width, const size_t &depth, const int &scale)
+{
+	if (width == 0 || depth == 0 || noise.size() < width * depth)
+	{
+		m_Levels.clear();
+		return;
+	}
+
+	// Rebuilding a map of the same size reuses every level's storage
+	ResizeLevels(width, depth);
+
+	Level &base = m_Levels[0];
+	base.Ranges.assign(width * depth, Range());
+	base.Data = base.Ranges.data();
+	for (size_t i = 0; i < width * depth; i++)
+	{
+		if (noise[i] < 0.0)
+			continue;
+
+		int height = int(noise[i] * scale);
+		base.Ranges[i] = { height, height };
+	}
+
+	// Every cell above level 0 covers the ranges of up to 2x2 cells in the level below
+	for (size_t i = 1; i < m_Levels.size(); i++)
+	{
+		const Level &below = m_Levels[i - 1];
+
+		Level &level = m_Levels[i];
+		level.Ranges.assign((size_t)level.Width * level.Depth, Range());
+		level.Data = level.Ranges.data();
+
+		for (int z = 0; z < below.Depth; z++)
+		{
+			for (int x = 0; x < below.Width; x++)
+			{
+				const Range &child = below.Ranges[x + z * below.Width];
+				Range &parent = level.Ranges[(x / 2) + (z / 2) * level.Width];
+				parent.Min = std::min(parent.Min, child.Min);
+				parent.Max = std::max(parent.Max, child.Max);
+			}
+		}
+	}
+}
+
+void HeightField::View(const size_t &width, const size_t &depth, const Range *ranges)
+{
+	if (width == 0 || depth == 0)
+	{
+		m_Levels.clear();
+		return;
+	}
+
+	ResizeLevels(width, depth);
+	for (auto &level : m_Levels)
+	{
+		// Release the built level, the viewed one replaces it
+		std::vector<Range>().swap(level.Ranges);
+		level.Data = ranges;
+		ranges += (size_t)level.Width * level.Depth;
+	}
+}
+
+size_t HeightField::GetRangeCount(const size_t &width, const size_t &depth)
+{
+	if (width == 0 || depth == 0)
+		return 0;
+
+	size_t count = width * depth;
+	for (size_t w = width, d = depth; w > 1 || d > 1;)
+	{
+		w = (w + 1) / 2;
+		d = (d + 1) / 2;
+		count += w * d;
+	}
+	return count;
+}
+
+void HeightField::ResizeLevels(const size_t &width, const size_t &depth)
+{
+	// Halve the map until a single cell covers all of it, odd sizes round up
+	size_t count = 1;
+	for (size_t w = width, d = depth; w > 1 || d > 1; w = (w + 1) / 2, d = (d + 1) / 2)
+		count++;
+	m_Levels.resize(count);
+
+	m_Levels[0].Width = (int)width;
+	m_Levels[0].Depth = (int)depth;
+	for (size_t i = 1; i < count; i++)
+	{
+		m_Levels[i].Width = (m_Levels[i - 1].Width + 1) / 2;
+		m_Levels[i].Depth = (m_Levels[i - 1].Depth + 1) / 2;
+	}
+}
+
+size_t HeightField::GetMemoryUsage() const
+{
+	size_t bytes = 0;
+	for (const auto &level : m_Levels)
+		bytes += level.Ranges.capacity() * sizeof(Range);
+	return bytes;
+}
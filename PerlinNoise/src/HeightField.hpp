@@ -0,0 +1,68 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <vector>
+
+// Min/max mip pyramid over the column heights of the noise map. The scene has one voxel per (x, z) column,
+// level 0 holds the height of that voxel and every level above covers 2x2 cells of the level below.
+// Rays can skip a whole cell when they pass above or below every voxel in it.
+// The levels are either built by Generate or viewed from storage elsewhere, such as a mapped scene file.
+class HeightField
+{
+public:
+	struct Range
+	{
+		// Columns without noise get an empty range that no ray overlaps
+		int Min = INT_MAX;
+		int Max = INT_MIN;
+	};
+
+public:
+	HeightField() = default;
+
+	// Heights are computed the same way as the scene's points, negative noise marks a missing column
+	void Generate(const std::vector<double> &noise, const size_t &width, const size_t &depth, const int &scale);
+
+	// Uses the ranges of every level stored one after the other from level 0 up without copying them, there must
+	// be GetRangeCount(width, depth) of them and they must stay valid until the next call to Generate or View
+	void View(const size_t &width, const size_t &depth, const Range *ranges);
+
+	// Number of ranges in all levels of a map of this size
+	static size_t GetRangeCount(const size_t &width, const size_t &depth);
+
+	bool IsEmpty() const { return m_Levels.empty(); }
+	int GetLevelCount() const { return (int)m_Levels.size(); }
+	int GetWidth(const int &level) const { return m_Levels[level].Width; }
+	int GetDepth(const int &level) const { return m_Levels[level].Depth; }
+
+	const Range& GetRange(const int &level, const int &x, const int &z) const
+	{
+		const Level &mip = m_Levels[level];
+		return mip.Data[x + z * mip.Width];
+	}
+
+	// Every range of one level, row by row
+	const Range* GetRanges(const int &level) const { return m_Levels[level].Data; }
+
+	// Range of the whole map
+	const Range& GetBounds() const { return m_Levels.back().Data[0]; }
+
+	size_t GetMemoryUsage() const;
+
+private:
+	struct Level
+	{
+		int Width = 0;
+		int Depth = 0;
+		std::vector<Range> Ranges;
+
+		// Points at Ranges or at the viewed storage
+		const Range *Data = nullptr;
+	};
+
+	// Sets the size of every level, keeping the storage of the ones that already exist
+	void ResizeLevels(const size_t &width, const size_t &depth);
+
+	std::vector<Level> m_Levels;
+};
@@ -0,0 +1,360 @@
+#include "HeightmapExporter.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Utils
+{
+	// CRC-32 every PNG chunk ends with
+	static uint32_t CRC32(uint32_t crc, const uint8_t *data, const size_t &size)
+	{
+		static const std::array<uint32_t, 256> table = []()
+			{
+				std::array<uint32_t, 256> table{};
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t c = i;
+					for (int k = 0; k < 8; k++)
+						c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					table[i] = c;
+				}
+				return table;
+			}();
+
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	static void PutBigEndian32(uint8_t *out, const uint32_t &value)
+	{
+		out[0] = (uint8_t)(value >> 24);
+		out[1] = (uint8_t)(value >> 16);
+		out[2] = (uint8_t)(value >> 8);
+		out[3] = (uint8_t)value;
+	}
+
+	// Writes one file of 16-bit heights a strip of rows at a time. PNGs hold the rows in a zlib stream of stored
+	// deflate blocks, which needs no compression library and only buffers the bytes of the strip being written.
+	class HeightmapFile
+	{
+	public:
+		~HeightmapFile() { Close(); }
+
+		bool Open(const std::string &path, const HeightmapExporter::Format &format, const size_t &width, const size_t &height)
+		{
+			m_File = std::fopen(path.c_str(), "wb");
+			if (!m_File)
+				return false;
+
+			m_Format = format;
+			m_Width = width;
+			m_Row.resize(width * 2 + 1);
+			if (m_Format == HeightmapExporter::Format::Raw)
+				return true;
+
+			static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+			if (std::fwrite(signature, 1, sizeof(signature), m_File) != sizeof(signature))
+				return false;
+
+			// 16-bit grayscale, no interlacing
+			uint8_t header[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 0, 0, 0 };
+			PutBigEndian32(header, (uint32_t)width);
+			PutBigEndian32(header + 4, (uint32_t)height);
+			if (!WriteChunk("IHDR", header, sizeof(header)))
+				return false;
+
+			// Every row starts with its filter type
+			m_Remaining = (uint64_t)height * (width * 2 + 1);
+			m_Stream = { 0x78, 0x01 };
+			return true;
+		}
+
+		// Writes rows of width heights that start stride heights apart
+		bool WriteRows(const uint16_t *heights, const size_t &rows, const size_t &stride)
+		{
+			bool png = m_Format == HeightmapExporter::Format::PNG16;
+			for (size_t j = 0; j < rows; j++)
+			{
+				const uint16_t *row = heights + j * stride;
+				if (png)
+				{
+					// Filter type 0, then big endian samples
+					m_Row[0] = 0;
+					for (size_t i = 0; i < m_Width; i++)
+					{
+						m_Row[1 + i * 2] = (uint8_t)(row[i] >> 8);
+						m_Row[2 + i * 2] = (uint8_t)row[i];
+					}
+					if (!Deflate(m_Row.data(), m_Row.size()))
+						return false;
+				}
+				else
+				{
+					for (size_t i = 0; i < m_Width; i++)
+					{
+						m_Row[i * 2] = (uint8_t)row[i];
+						m_Row[i * 2 + 1] = (uint8_t)(row[i] >> 8);
+					}
+					if (std::fwrite(m_Row.data(), 1, m_Width * 2, m_File) != m_Width * 2)
+						return false;
+				}
+			}
+
+			// Each strip goes out as one IDAT chunk
+			if (png && !m_Stream.empty())
+			{
+				if (!WriteChunk("IDAT", m_Stream.data(), m_Stream.size()))
+					return false;
+				m_Stream.clear();
+			}
+			return true;
+		}
+
+		// Returns false if the file is missing rows or could not be written
+		bool Close()
+		{
+			if (!m_File)
+				return false;
+
+			bool written = true;
+			if (m_Format == HeightmapExporter::Format::PNG16)
+			{
+				uint8_t adler[4];
+				PutBigEndian32(adler, (m_AdlerB << 16) | m_AdlerA);
+				m_Stream.insert(m_Stream.end(), adler, adler + 4);
+
+				// IEND has no data, but fwrite still needs a valid buffer
+				static const uint8_t end = 0;
+				written = m_Remaining == 0 && WriteChunk("IDAT", m_Stream.data(), m_Stream.size()) && WriteChunk("IEND", &end, 0);
+			}
+
+			written = std::fclose(m_File) == 0 && written;
+			m_File = nullptr;
+			return written;
+		}
+
+	private:
+		bool WriteChunk(const char *type, const uint8_t *data, const size_t &size)
+		{
+			uint8_t header[8];
+			PutBigEndian32(header, (uint32_t)size);
+			std::copy(type, type + 4, header + 4);
+
+			uint8_t crc[4];
+			PutBigEndian32(crc, CRC32(CRC32(0, header + 4, 4), data, size));
+
+			return std::fwrite(header, 1, 8, m_File) == 8 && (size == 0 || std::fwrite(data, 1, size, m_File) == size) &&
+				std::fwrite(crc, 1, 4, m_File) == 4;
+		}
+
+		// Appends data to the zlib stream in stored blocks of up to 65535 bytes, the last block of the image is marked final
+		bool Deflate(const uint8_t *data, size_t size)
+		{
+			if (size > m_Remaining)
+				return false;
+			m_Remaining -= size;
+
+			// The Adler-32 sums can go 5552 bytes before they have to be reduced
+			for (size_t first = 0; first < size; first += 5552)
+			{
+				size_t last = std::min(first + 5552, size);
+				for (size_t i = first; i < last; i++)
+				{
+					m_AdlerA += data[i];
+					m_AdlerB += m_AdlerA;
+				}
+				m_AdlerA %= 65521;
+				m_AdlerB %= 65521;
+			}
+
+			while (size > 0)
+			{
+				size_t count = std::min(size, 65535 - m_Block.size());
+				m_Block.insert(m_Block.end(), data, data + count);
+				data += count;
+				size -= count;
+
+				bool finalBlock = m_Remaining == 0 && size == 0;
+				if (m_Block.size() < 65535 && !finalBlock)
+					continue;
+
+				uint16_t length = (uint16_t)m_Block.size();
+				uint8_t header[5] = { (uint8_t)(finalBlock ? 1 : 0), (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)~length, (uint8_t)(~length >> 8) };
+				m_Stream.insert(m_Stream.end(), header, header + 5);
+				m_Stream.insert(m_Stream.end(), m_Block.begin(), m_Block.end());
+				m_Block.clear();
+			}
+			return true;
+		}
+
+	private:
+		FILE *m_File = nullptr;
+		HeightmapExporter::Format m_Format = HeightmapExporter::Format::PNG16;
+		size_t m_Width = 0;
+		std::vector<uint8_t> m_Row;
+
+		// Image bytes not deflated yet, the block being filled and the zlib bytes of the next IDAT chunk
+		uint64_t m_Remaining = 0;
+		std::vector<uint8_t> m_Block;
+		std::vector<uint8_t> m_Stream;
+		uint32_t m_AdlerA = 1;
+		uint32_t m_AdlerB = 0;
+	};
+
+	// Inserts the tile's coordinates before the extension, terrain.png becomes terrain_<x>_<y>.png
+	static std::string TilePath(const std::string &path, const size_t &x, const size_t &y)
+	{
+		size_t slash = path.find_last_of("/\\");
+		size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			dot = path.size();
+
+		return path.substr(0, dot) + "_" + std::to_string(x) + "_" + std::to_string(y) + path.substr(dot);
+	}
+}
+
+bool HeightmapExporter::Export(const std::string &path, const PerlinNoiseGenerator &generator, const Settings &settings)
+{
+	size_t width = settings.Width;
+	size_t height = settings.Height;
+	size_t tileSize = settings.TileSize;
+	if (width == 0 || height == 0)
+		return false;
+
+	// Strips are full rows of the map, or single tiles in row order when it is split into tiles
+	size_t stripWidth = tileSize ? std::min(tileSize, width) : width;
+	size_t stripRows = std::min(tileSize ? tileSize : std::max((size_t)settings.StripRows, (size_t)1), height);
+	size_t stripsX = (width + stripWidth - 1) / stripWidth;
+	size_t strips = stripsX * ((height + stripRows - 1) / stripRows);
+	size_t depth = std::clamp((size_t)settings.QueueDepth, (size_t)1, strips);
+
+	m_RowsWritten = 0;
+	m_TotalRows = height * stripsX;
+	m_QueueMemory = depth * stripRows * stripWidth * sizeof(uint16_t);
+
+	// Sampling only needs the parameters, so the map is never held as a whole
+	PerlinNoiseGenerator sampler(generator.GetSeed(), 1, 1, generator.GetCellSize(), generator.GetLevels(), generator.GetAttenuation());
+
+	Utils::HeightmapFile file;
+	if (!tileSize && !file.Open(path, settings.FileFormat, width, height))
+		return false;
+
+	// Strip s is generated into slot s % depth, and once it has been written the slot takes strip s + depth
+	struct Slot
+	{
+		std::vector<uint16_t> Heights;
+		bool Ready = false;
+	};
+	std::vector<Slot> slots(depth);
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	auto generate = [&](size_t strip)
+		{
+			Slot &slot = slots[strip % depth];
+			size_t x = (strip % stripsX) * stripWidth;
+			size_t y = (strip / stripsX) * stripRows;
+			size_t columns = std::min(stripWidth, width - x);
+			size_t rows = std::min(stripRows, height - y);
+			slot.Heights.resize(rows * columns);
+
+			ThreadPool::Get().ParallelFor(rows, [&](size_t row)
+				{
+					sampler.SampleRegion((int)x, (int)(y + row), columns, 1, &slot.Heights[row * columns], columns);
+				});
+
+			// Notified under the lock, the writer may return as soon as it sees the last strip
+			std::lock_guard<std::mutex> lock(mutex);
+			slot.Ready = true;
+			condition.notify_one();
+		};
+
+	size_t submitted = 0;
+	auto submit = [&]()
+		{
+			size_t strip = submitted++;
+			ThreadPool::Get().Submit([&generate, strip]() { generate(strip); });
+		};
+	while (submitted < depth)
+		submit();
+
+	// After a failed write the strips already queued are waited for but nothing more is generated
+	bool written = true;
+	for (size_t strip = 0; strip < submitted; strip++)
+	{
+		Slot &slot = slots[strip % depth];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&]() { return slot.Ready; });
+			slot.Ready = false;
+		}
+
+		size_t columns = std::min(stripWidth, width - (strip % stripsX) * stripWidth);
+		size_t rows = slot.Heights.size() / columns;
+		if (written && tileSize)
+		{
+			Utils::HeightmapFile tile;
+			written = tile.Open(Utils::TilePath(path, strip % stripsX, strip / stripsX), settings.FileFormat, columns, rows) &&
+				tile.WriteRows(slot.Heights.data(), rows, columns) && tile.Close();
+		}
+		else if (written)
+		{
+			written = file.WriteRows(slot.Heights.data(), rows, width);
+		}
+		m_RowsWritten += rows;
+
+		if (written && submitted < strips)
+			submit();
+	}
+
+	if (!tileSize)
+	{
+		written = file.Close() && written;
+		if (!written)
+			std::remove(path.c_str());
+	}
+	return written;
+}
+
+void HeightmapExporter::ExportAsync(const std::string &path, const PerlinNoiseGenerator &generator, const Settings &settings)
+{
+	Wait();
+
+	// The thread keeps its own copy of the parameters in case the generator changes while it runs
+	auto parameters = std::make_shared<const PerlinNoiseGenerator>(generator.GetSeed(), 1, 1,
+		generator.GetCellSize(), generator.GetLevels(), generator.GetAttenuation());
+
+	m_Exporting = true;
+	m_Thread = std::thread([this, path, parameters, settings]()
+		{
+			m_Result = Export(path, *parameters, settings);
+			m_Exporting = false;
+		});
+}
+
+bool HeightmapExporter::Wait()
+{
+	if (m_Thread.joinable())
+		m_Thread.join();
+	return m_Result;
+}
+
+HeightmapExporter::Format HeightmapExporter::GetFormat(const std::string &path)
+{
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos)
+		return Format::Raw;
+
+	std::string extension = path.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+	return extension == ".png" ? Format::PNG16 : Format::Raw;
+}
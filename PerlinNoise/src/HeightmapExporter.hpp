@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "PerlinNoise.hpp"
+
+// Bakes maps of any size straight to disk as 16-bit heights. The map is generated in strips of rows on the
+// shared thread pool while the exporting thread writes the finished strips in order, so peak memory is a few
+// strips no matter how large the map is. Heights are sampled like SampleRegion<uint16_t>, so they are within one
+// step of the generator's map quantised with PerlinNoiseGenerator::QuantizeHeight.
+class HeightmapExporter
+{
+public:
+	enum class Format
+	{
+		PNG16, // 16-bit grayscale PNG, stored without compression so it can be streamed
+		Raw,   // Little endian 16-bit heights row by row without a header
+	};
+
+	struct Settings
+	{
+		Format   FileFormat = Format::PNG16;
+		uint32_t Width      = 4096;
+		uint32_t Height     = 4096;
+
+		// Splits the map into files of TileSize x TileSize heights named <name>_<x>_<y>.<extension>, 0 writes one file
+		uint32_t TileSize   = 0;
+
+		// Rows generated together, tiled exports generate one tile at a time instead
+		uint32_t StripRows  = 64;
+
+		// Strips generated ahead of the one being written, including it
+		uint32_t QueueDepth = 4;
+	};
+
+public:
+	HeightmapExporter() = default;
+	~HeightmapExporter() { Wait(); }
+
+	HeightmapExporter(const HeightmapExporter&) = delete;
+	HeightmapExporter& operator=(const HeightmapExporter&) = delete;
+
+	// Exports the map generator's parameters make, returns false if a file could not be written
+	bool Export(const std::string &path, const PerlinNoiseGenerator &generator, const Settings &settings);
+
+	// Exports on a thread of its own, Wait() returns the result
+	void ExportAsync(const std::string &path, const PerlinNoiseGenerator &generator, const Settings &settings);
+	bool IsExporting() const { return m_Exporting; }
+	bool Wait();
+
+	float GetProgress() const { return m_TotalRows ? (float)m_RowsWritten / (float)m_TotalRows : 0.0f; }
+
+	// Bytes held by the strip queue of the last export, the most it uses at any time
+	size_t GetQueueMemory() const { return m_QueueMemory; }
+
+	// Picks the format from the extension, .png is PNG16 and anything else is Raw
+	static Format GetFormat(const std::string &path);
+
+private:
+	std::thread m_Thread;
+	std::atomic<bool> m_Exporting{ false };
+	bool m_Result = false;
+
+	std::atomic<size_t> m_RowsWritten{ 0 };
+	std::atomic<size_t> m_TotalRows{ 0 };
+	std::atomic<size_t> m_QueueMemory{ 0 };
+};
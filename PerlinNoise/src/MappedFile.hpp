@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only mapping of a whole file. Nothing is read up front, the OS pages the file in as it is touched
+// and can drop clean pages again under memory pressure, so files larger than the free memory still work.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Returns false if the file does not exist, is empty, or cannot be mapped
+	bool Open(const std::string &path);
+	void Close();
+
+	bool IsOpen() const { return m_Data != nullptr; }
+	const uint8_t* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+
+private:
+	const uint8_t *m_Data = nullptr;
+	size_t m_Size = 0;
+
+#ifdef _WIN32
+	void *m_File = nullptr;
+	void *m_Mapping = nullptr;
+#endif
+};
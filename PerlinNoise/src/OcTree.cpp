@@ -1,100 +1,259 @@
 #include "OcTree.hpp"
+#include "ThreadPool.hpp"
 
-void OcTree::AddPoint(const glm::vec3 &point)
+#include <algorithm>
+#include <cmath>
+
+namespace Utils
 {
-	// Check if we contain the point
-	if (!m_Oct.ContainsPoint(point))
-		return;
+	// Spreads the low 21 bits of value out so there are two zero bits between each of them
+	static uint64_t SpreadBits(uint64_t value)
+	{
+		value &= 0x1fffff;
+		value = (value | value << 32) & 0x1f00000000ffffull;
+		value = (value | value << 16) & 0x1f0000ff0000ffull;
+		value = (value | value << 8) & 0x100f00f00f00f00full;
+		value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+		value = (value | value << 2) & 0x1249249249249249ull;
+		return value;
+	}
 
-	// If we contain the point and have room, add the point
-	if (m_Points.size() < m_Capacity)
+	// Interleaves the cell coordinates so the three lowest bits are the child index in the level above
+	static uint64_t MortonCode(const glm::ivec3 &cell)
 	{
-		m_Points.push_back(point);
-		return;
+		return SpreadBits((uint64_t)cell.x) | (SpreadBits((uint64_t)cell.y) << 1) | (SpreadBits((uint64_t)cell.z) << 2);
 	}
 
-	// If we have not subdivided are at capacity, add the point and subdivide
-	if (!m_SubDivided)
+	// Splits count items into blocks that are handed out to the thread pool
+	static constexpr size_t BuildBlockSize = 16384;
+
+	template<typename Function>
+	static void ParallelBlocks(const size_t &count, const Function &function)
 	{
-		m_Points.push_back(point);
-		SubDivide();
-		m_SubDivided = true;
+		size_t blocks = (count + BuildBlockSize - 1) / BuildBlockSize;
+		ThreadPool::Get().ParallelFor(blocks, [&](size_t block)
+			{
+				size_t first = block * BuildBlockSize;
+				function(first, std::min(first + BuildBlockSize, count));
+			});
 	}
-	
-	// If we have subdivided, add the points to the children
-	for (const auto &octs : m_Children)
+
+	// Keeps the items for which keep(i) is true in their order. Every block counts the items it keeps, a prefix sum
+	// over the counts gives each block the position of its first one, then resize(total) is called and the blocks
+	// call emit(i, position) for their kept items.
+	template<typename Keep, typename Resize, typename Emit>
+	static void ParallelCompact(const size_t &count, const Keep &keep, const Resize &resize, const Emit &emit)
 	{
-		octs->AddPoint(point);
+		std::vector<size_t> starts((count + BuildBlockSize - 1) / BuildBlockSize + 1, 0);
+		ParallelBlocks(count, [&](size_t first, size_t last)
+			{
+				size_t kept = 0;
+				for (size_t i = first; i < last; i++)
+					kept += keep(i) ? 1 : 0;
+				starts[first / BuildBlockSize + 1] = kept;
+			});
+
+		for (size_t block = 1; block < starts.size(); block++)
+			starts[block] += starts[block - 1];
+		resize(starts.back());
+
+		ParallelBlocks(count, [&](size_t first, size_t last)
+			{
+				size_t position = starts[first / BuildBlockSize];
+				for (size_t i = first; i < last; i++)
+				{
+					if (keep(i))
+						emit(i, position++);
+				}
+			});
 	}
 }
 
-void OcTree::Generate(const uint32_t &size, const std::vector<glm::vec3> points)
+void OcTree::Generate(const uint32_t &size, const std::vector<glm::vec3> &points)
 {
-	// Clear the data for the octree and recreate it
-	m_Children.clear();
+	// The tree halves down to 1x1x1 leaves, so round the size up to a power of two
+	m_Size = 1;
+	int depth = 0;
+	while (m_Size < size)
+	{
+		m_Size *= 2;
+		depth++;
+	}
+
+	m_Nodes.clear();
 	m_Points.clear();
-	m_SubDivided = false;
-	m_Size = size;
-	float sizef = (float)size / 2.0f;
-	
-	glm::vec3 origin = glm::vec3(sizef, sizef, sizef);
-	glm::vec3 dim = glm::vec3(sizef, sizef, sizef);
-	m_Oct = AABB(origin, dim);
-
-	if (size == 1)
-		m_Capacity = 1;
-	else
-		m_Capacity = 0;
-
-	for (const auto &point : points)
-		AddPoint(point);
-}
 
-int OcTree::GetOctCount()
-{
-	// Return the number of Octs generated
-	int count = 1;
-	for (int i = 0; i < m_Children.size(); i++)
+	// Morton encode every point, points outside the tree get a code that sorts after all the others
+	uint64_t outside = 1ull << (3 * depth);
+	std::vector<uint64_t> codes(points.size());
+	std::vector<uint32_t> indices(points.size());
+	Utils::ParallelBlocks(points.size(), [&](size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; i++)
+			{
+				const glm::vec3 &point = points[i];
+				glm::ivec3 cell = glm::ivec3((int)std::floor(point.x), (int)std::floor(point.y), (int)std::floor(point.z));
+				bool inside = cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x < (int)m_Size && cell.y < (int)m_Size && cell.z < (int)m_Size;
+
+				codes[i] = inside ? Utils::MortonCode(cell) : outside;
+				indices[i] = (uint32_t)i;
+			}
+		});
+
+	RadixSort(codes, indices, 3 * depth + 1);
+
+	// Sorted codes list the leaves in order, leaves keep the first point in their voxel
+	std::vector<std::vector<uint64_t>> levels(depth + 1);
+	std::vector<uint64_t> &leaves = levels[depth];
+	size_t insideCount = std::lower_bound(codes.begin(), codes.end(), outside) - codes.begin();
+	Utils::ParallelCompact(insideCount,
+		[&](size_t i) { return i == 0 || codes[i] != codes[i - 1]; },
+		[&](size_t total) { leaves.resize(total); m_Points.resize(total); },
+		[&](size_t i, size_t leaf)
+		{
+			leaves[leaf] = codes[i];
+			m_Points[leaf] = points[indices[i]];
+		});
+
+	if (leaves.empty())
 	{
-		count += m_Children[i]->GetOctCount();
+		UseOwnedStorage();
+		return;
 	}
-	return count;
-}
 
-void OcTree::GetAllPoints(std::vector<glm::vec3> &points)
-{
-	// Get the number of points in the scene
-	for (const auto &point : m_Points)
+	// Build each level from the one below it, a parent's code is its children's codes without the lowest three bits.
+	// The children of a parent are next to each other in the level below, starting at firstChild.
+	std::vector<std::vector<uint32_t>> firstChild(depth);
+	for (int level = depth - 1; level >= 0; level--)
 	{
-		if (m_Size == 1) points.push_back(point);
+		const std::vector<uint64_t> &children = levels[level + 1];
+		Utils::ParallelCompact(children.size(),
+			[&](size_t i) { return i == 0 || (children[i] >> 3) != (children[i - 1] >> 3); },
+			[&](size_t total) { levels[level].resize(total); firstChild[level].resize(total); },
+			[&](size_t i, size_t parent)
+			{
+				levels[level][parent] = children[i] >> 3;
+				firstChild[level][parent] = (uint32_t)i;
+			});
 	}
-}
 
-void OcTree::GetAllChildren(std::vector<OcTree*> &children)
-{
-	// Get the all descendents of the Oct that have points
-	if (m_Size == 1 && m_Points.size() == 1)
-		children.push_back(this);
+	// Lay the levels out one after the other starting at the root
+	std::vector<uint32_t> offsets(depth + 2, 0);
+	for (int level = 0; level <= depth; level++)
+		offsets[level + 1] = offsets[level] + (uint32_t)levels[level].size();
+	m_Nodes.resize(offsets[depth + 1]);
 
-	for (const auto &child : m_Children)
+	for (int level = 0; level < depth; level++)
 	{
-		child->GetAllChildren(children);
+		const std::vector<uint64_t> &children = levels[level + 1];
+		const std::vector<uint32_t> &starts = firstChild[level];
+
+		Utils::ParallelBlocks(starts.size(), [&](size_t first, size_t last)
+			{
+				for (size_t i = first; i < last; i++)
+				{
+					uint32_t begin = starts[i];
+					uint32_t end = (i + 1 < starts.size()) ? starts[i + 1] : (uint32_t)children.size();
+
+					Node &node = m_Nodes[offsets[level] + i];
+					node.Index = offsets[level + 1] + begin;
+					node.ChildMask = 0;
+					for (uint32_t child = begin; child < end; child++)
+						node.ChildMask |= (uint8_t)(1 << (children[child] & 7));
+				}
+			});
 	}
+
+	// Leaves point at their point, which are stored in the same order
+	Utils::ParallelBlocks(leaves.size(), [&](size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; i++)
+				m_Nodes[offsets[depth] + i] = { (uint32_t)i, 0 };
+		});
+
+	UseOwnedStorage();
+}
+
+void OcTree::View(const uint32_t &size, const Node *nodes, const size_t &nodeCount, const glm::vec3 *points, const size_t &pointCount)
+{
+	m_Size = size;
+
+	// Release the built tree, the viewed one replaces it
+	std::vector<Node>().swap(m_Nodes);
+	std::vector<glm::vec3>().swap(m_Points);
+
+	m_NodeData = nodes;
+	m_NodeCount = nodeCount;
+	m_PointData = points;
+	m_PointCount = pointCount;
+}
+
+void OcTree::UseOwnedStorage()
+{
+	m_NodeData = m_Nodes.data();
+	m_NodeCount = m_Nodes.size();
+	m_PointData = m_Points.data();
+	m_PointCount = m_Points.size();
 }
 
-void OcTree::SubDivide()
+void OcTree::GetAllPoints(std::vector<glm::vec3> &points) const
 {
-	uint32_t size = m_Size / 2;
-	float sizef = (float)m_Size / 4.0f;
-	glm::vec3 dims = glm::vec3(sizef, sizef, sizef);
-
-	// Divide up the oct into equally spaced eights
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x - sizef, m_Oct.Origin.y - sizef, m_Oct.Origin.z - sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x + sizef, m_Oct.Origin.y - sizef, m_Oct.Origin.z - sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x - sizef, m_Oct.Origin.y - sizef, m_Oct.Origin.z + sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x + sizef, m_Oct.Origin.y - sizef, m_Oct.Origin.z + sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x - sizef, m_Oct.Origin.y + sizef, m_Oct.Origin.z - sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x + sizef, m_Oct.Origin.y + sizef, m_Oct.Origin.z - sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x - sizef, m_Oct.Origin.y + sizef, m_Oct.Origin.z + sizef), dims), size));
-	m_Children.push_back(new OcTree(AABB(glm::vec3(m_Oct.Origin.x + sizef, m_Oct.Origin.y + sizef, m_Oct.Origin.z + sizef), dims), size));
+	points.insert(points.end(), m_PointData, m_PointData + m_PointCount);
+}
+
+void OcTree::RadixSort(std::vector<uint64_t> &codes, std::vector<uint32_t> &indices, const int &bits)
+{
+	// Least significant digit first, each pass is stable so the points in a voxel stay in their original order
+	constexpr int DigitBits = 8;
+	constexpr size_t Buckets = 1 << DigitBits;
+
+	std::vector<uint64_t> sortedCodes(codes.size());
+	std::vector<uint32_t> sortedIndices(indices.size());
+
+	// Every block counts its own digits, block b writes a digit after the same digit of blocks 0 to b - 1
+	size_t blocks = (codes.size() + Utils::BuildBlockSize - 1) / Utils::BuildBlockSize;
+	std::vector<size_t> offsets(blocks * Buckets);
+
+	for (int shift = 0; shift < bits; shift += DigitBits)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		Utils::ParallelBlocks(codes.size(), [&](size_t first, size_t last)
+			{
+				size_t *blockOffsets = &offsets[first / Utils::BuildBlockSize * Buckets];
+				for (size_t i = first; i < last; i++)
+					blockOffsets[(codes[i] >> shift) & (Buckets - 1)]++;
+			});
+
+		// Skip the pass if every code has the same digit
+		bool sorted = false;
+		size_t total = 0;
+		for (size_t digit = 0; digit < Buckets && !sorted; digit++)
+		{
+			size_t digitTotal = total;
+			for (size_t block = 0; block < blocks; block++)
+			{
+				size_t count = offsets[block * Buckets + digit];
+				offsets[block * Buckets + digit] = total;
+				total += count;
+			}
+			sorted = total - digitTotal == codes.size();
+		}
+
+		if (sorted)
+			continue;
+
+		Utils::ParallelBlocks(codes.size(), [&](size_t first, size_t last)
+			{
+				size_t *blockOffsets = &offsets[first / Utils::BuildBlockSize * Buckets];
+				for (size_t i = first; i < last; i++)
+				{
+					size_t destination = blockOffsets[(codes[i] >> shift) & (Buckets - 1)]++;
+					sortedCodes[destination] = codes[i];
+					sortedIndices[destination] = indices[i];
+				}
+			});
+
+		codes.swap(sortedCodes);
+		indices.swap(sortedIndices);
+	}
 }
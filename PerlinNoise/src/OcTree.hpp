@@ -3,56 +3,83 @@
 #include <vector>
 #include <memory>
 
-#include "AABB.hpp"
+#include <glm/glm.hpp>
 
+// Sparse octree over the cube [0, size) stored as one contiguous array of nodes. Only children that
+// contain points are stored, the children of a node sit next to each other in child index order.
+// Nodes do not store their bounds, they are derived from the parent's bounds while walking down the tree.
+// The nodes are laid out level by level, and every level is sorted by the Morton code of its nodes.
+// A tree either owns the nodes and points it built, or views ones stored elsewhere such as a mapped scene file.
 class OcTree
 {
 public:
-	OcTree() = default;
-	~OcTree()
-	{
-		// No memory leaks please
-		for (int i = 0; i < m_Children.size(); i++)
-		{
-			delete m_Children[i];
-		}
-	}
-	
-	OcTree(const AABB &oct, const uint32_t size) 
-		: m_Oct(oct), m_Size(size) 
+	struct Node
 	{
-		if (size == 1) m_Capacity = 1;
-	}
+		// Inner nodes store the index of their first child, leaves store the index of their point
+		uint32_t Index = 0;
+
+		// Bit i is set if child i exists, leaves have no children
+		uint8_t ChildMask = 0;
+	};
+
+public:
+	OcTree() = default;
+
+	void Generate(const uint32_t &size, const std::vector<glm::vec3> &points);
 
-	void AddPoint(const glm::vec3 &point);
-	void Generate(const uint32_t &size, const std::vector<glm::vec3> points);
+	// Uses nodes and points laid out the same way as a generated tree without copying them, they must stay valid
+	// until the next call to Generate or View
+	void View(const uint32_t &size, const Node *nodes, const size_t &nodeCount, const glm::vec3 *points, const size_t &pointCount);
 
-	const uint32_t& GetSize() { return m_Size; }
-	const AABB& GetOct() const { return m_Oct; }
-	OcTree *GetChild(const int &i) 
+	// Child i covers the half of its parent with x, y and z set by bits 0, 1 and 2
+	static glm::vec3 ChildOffset(const int &i) { return glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1); }
+
+	// Index of child i of node, child i must exist
+	static uint32_t ChildIndex(const Node &node, const int &i)
 	{
-		if (i > -1 && i < m_Children.size()) return m_Children[i];
-		else return nullptr;
+		return node.Index + CountBits(node.ChildMask & ((1u << i) - 1));
 	}
-	const std::vector<OcTree*>& GetChildren() const { return m_Children; }
-	const std::vector<glm::vec3>& GetPoints() const { return m_Points; }
-	const int GetPointCount() const { return m_Points.size(); };
 
-	int GetOctCount();
-	void GetAllPoints(std::vector<glm::vec3> &points);
-	void GetAllChildren(std::vector<OcTree*> &children);
+	const uint32_t& GetSize() const { return m_Size; }
+	bool IsEmpty() const { return m_NodeCount == 0; }
+
+	const Node& GetRoot() const { return m_NodeData[0]; }
+	const Node& GetNode(const uint32_t &index) const { return m_NodeData[index]; }
+	const Node* GetNodes() const { return m_NodeData; }
+
+	const glm::vec3& GetPoint(const Node &leaf) const { return m_PointData[leaf.Index]; }
+	const glm::vec3* GetPoints() const { return m_PointData; }
+	const int GetPointCount() const { return (int)m_PointCount; }
 
+	int GetOctCount() const { return (int)m_NodeCount; }
+	// Viewed nodes and points belong to whoever stores them and are not counted
+	size_t GetMemoryUsage() const { return m_Nodes.capacity() * sizeof(Node) + m_Points.capacity() * sizeof(glm::vec3); }
+	void GetAllPoints(std::vector<glm::vec3> &points) const;
 
 private:
-	void SubDivide();
+	static uint32_t CountBits(uint32_t bits)
+	{
+		uint32_t count = 0;
+		for (; bits; bits &= bits - 1)
+			count++;
+		return count;
+	}
+
+	// Sorts the Morton codes of the points, keeping every index with its code
+	static void RadixSort(std::vector<uint64_t> &codes, std::vector<uint32_t> &indices, const int &bits);
+
+	// Points the views at the nodes and points the tree owns
+	void UseOwnedStorage();
 
 private:
-	AABB m_Oct;
 	uint32_t m_Size = 0;
 
-	size_t m_Capacity = 0;
-	bool m_SubDivided = false;
-
+	std::vector<Node> m_Nodes = {};
 	std::vector<glm::vec3> m_Points = {};
-	std::vector<OcTree*> m_Children = {};
-};
\ No newline at end of file
+
+	// Every lookup goes through these, they point at m_Nodes and m_Points or at the viewed storage
+	const Node *m_NodeData = nullptr;
+	size_t m_NodeCount = 0;
+	const glm::vec3 *m_PointData = nullptr;
+	size_t m_PointCount = 0;
+};
@@ -1,6 +1,24 @@
 #include <algorithm>
+#include <cmath>
+#include <type_traits>
 
 #include "PerlinNoise.hpp"
+#include "ThreadPool.hpp"
+
+#include <thread>
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PN_TARGET_AVX2
+#else
+#define PN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Preview heights are scaled to palette levels 4 at a time with SSE2, which every x64 CPU has
+#if !defined(PN_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define PN_PREVIEW_SIMD
+#endif
 
 namespace Utils
 {
@@ -16,15 +34,460 @@ namespace Utils
         return a + t*(b - a);
     }
 
-    void DrawGrid(ImDrawList *drawlist, const ImVec2 &p0, const ImVec2 &p1, const ImVec2 &gridsize, const int &cellsize, const ImU32 &linecolor)
+    // Integer hash from "Hash Functions for GPU Rendering" (Jarzynski and Olano 2020), a single round of the PCG generator
+    static uint32_t PCGHash(const uint32_t &input)
+    {
+        uint32_t state = input * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    // The influence vectors are picked from 16 evenly spaced directions. Using fixed values instead of
+    // cos/sin keeps the gradients identical on every platform for a given seed.
+    alignas(16) static const float GradientX[16] = {
+         1.0f,  0.92387953f,  0.70710678f,  0.38268343f,  0.0f, -0.38268343f, -0.70710678f, -0.92387953f,
+        -1.0f, -0.92387953f, -0.70710678f, -0.38268343f,  0.0f,  0.38268343f,  0.70710678f,  0.92387953f };
+    alignas(16) static const float GradientY[16] = {
+         0.0f,  0.38268343f,  0.70710678f,  0.92387953f,  1.0f,  0.92387953f,  0.70710678f,  0.38268343f,
+         0.0f, -0.38268343f, -0.70710678f, -0.92387953f, -1.0f, -0.92387953f, -0.70710678f, -0.38268343f };
+
+    // Hashes a lattice row once so every point on it only needs one more hash
+    static uint32_t HashRow(const uint32_t &seedHash, const int &y)
+    {
+        return PCGHash((uint32_t)y + seedHash);
+    }
+
+    static glm::vec2 Gradient(const uint32_t &rowHash, const int &x)
+    {
+        uint32_t index = PCGHash((uint32_t)x + rowHash) & 15u;
+        return glm::vec2(GradientX[index], GradientY[index]);
+    }
+
+    // The 12 edge directions of a cube from Perlin's improved noise, with 4 of them repeated to fill 16 entries.
+    // Plain floats so the batched kernels can gather every axis from them.
+    static const float Gradient3D[16][3] = {
+        {  1.0f,  1.0f,  0.0f }, { -1.0f,  1.0f,  0.0f }, {  1.0f, -1.0f,  0.0f }, { -1.0f, -1.0f,  0.0f },
+        {  1.0f,  0.0f,  1.0f }, { -1.0f,  0.0f,  1.0f }, {  1.0f,  0.0f, -1.0f }, { -1.0f,  0.0f, -1.0f },
+        {  0.0f,  1.0f,  1.0f }, {  0.0f, -1.0f,  1.0f }, {  0.0f,  1.0f, -1.0f }, {  0.0f, -1.0f, -1.0f },
+        {  1.0f,  1.0f,  0.0f }, {  0.0f, -1.0f,  1.0f }, { -1.0f,  1.0f,  0.0f }, {  0.0f, -1.0f, -1.0f } };
+
+    // The edge directions have length sqrt(2) in 3D and sqrt(3) in 4D
+    constexpr double Noise3DScale = 0.70710678118654752;
+    constexpr double Noise4DScale = 0.57735026918962576;
+
+    // Dot product of the corner offset with one of the 12 3D edge directions, picked by the corner's hash
+    static double Gradient3(const uint32_t &rowHash, const int &x, const double &dx, const double &dy, const double &dz)
+    {
+        const float *gradient = Gradient3D[PCGHash((uint32_t)x + rowHash) & 15u];
+        return gradient[0] * dx + gradient[1] * dy + gradient[2] * dz;
+    }
+
+    // The 32 edge directions of a hypercube, 0 along one axis and +-1 along the other three
+    static const float Gradient4D[32][4] = {
+        {  0.0f,  1.0f,  1.0f,  1.0f }, {  0.0f, -1.0f,  1.0f,  1.0f }, {  0.0f,  1.0f, -1.0f,  1.0f }, {  0.0f, -1.0f, -1.0f,  1.0f },
+        {  0.0f,  1.0f,  1.0f, -1.0f }, {  0.0f, -1.0f,  1.0f, -1.0f }, {  0.0f,  1.0f, -1.0f, -1.0f }, {  0.0f, -1.0f, -1.0f, -1.0f },
+        {  1.0f,  0.0f,  1.0f,  1.0f }, { -1.0f,  0.0f,  1.0f,  1.0f }, {  1.0f,  0.0f, -1.0f,  1.0f }, { -1.0f,  0.0f, -1.0f,  1.0f },
+        {  1.0f,  0.0f,  1.0f, -1.0f }, { -1.0f,  0.0f,  1.0f, -1.0f }, {  1.0f,  0.0f, -1.0f, -1.0f }, { -1.0f,  0.0f, -1.0f, -1.0f },
+        {  1.0f,  1.0f,  0.0f,  1.0f }, { -1.0f,  1.0f,  0.0f,  1.0f }, {  1.0f, -1.0f,  0.0f,  1.0f }, { -1.0f, -1.0f,  0.0f,  1.0f },
+        {  1.0f,  1.0f,  0.0f, -1.0f }, { -1.0f,  1.0f,  0.0f, -1.0f }, {  1.0f, -1.0f,  0.0f, -1.0f }, { -1.0f, -1.0f,  0.0f, -1.0f },
+        {  1.0f,  1.0f,  1.0f,  0.0f }, { -1.0f,  1.0f,  1.0f,  0.0f }, {  1.0f, -1.0f,  1.0f,  0.0f }, { -1.0f, -1.0f,  1.0f,  0.0f },
+        {  1.0f,  1.0f, -1.0f,  0.0f }, { -1.0f,  1.0f, -1.0f,  0.0f }, {  1.0f, -1.0f, -1.0f,  0.0f }, { -1.0f, -1.0f, -1.0f,  0.0f } };
+
+    static double Gradient4(const uint32_t &rowHash, const int &x, const double &dx, const double &dy, const double &dz, const double &dw)
+    {
+        const float *gradient = Gradient4D[PCGHash((uint32_t)x + rowHash) & 31u];
+        return gradient[0] * dx + gradient[1] * dy + gradient[2] * dz + gradient[3] * dw;
+    }
+
+    // Checks once whether the CPU and OS support AVX2 so the batched kernels can fall back to scalar code
+    static bool SupportsAVX2()
+    {
+#if defined(PN_NO_SIMD)
+        return false;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+
+        return osxsave && avx2 && (_xgetbv(0) & 0x6) == 0x6;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+    static const bool HasAVX2 = SupportsAVX2();
+
+    // PCGHash on 4 lanes
+    PN_TARGET_AVX2 static __m128i PCGHash4(const __m128i &input)
+    {
+        __m128i state = _mm_add_epi32(_mm_mullo_epi32(input, _mm_set1_epi32((int)747796405u)), _mm_set1_epi32((int)2891336453u));
+        __m128i shift = _mm_add_epi32(_mm_srli_epi32(state, 28), _mm_set1_epi32(4));
+        __m128i word = _mm_mullo_epi32(_mm_xor_si128(_mm_srlv_epi32(state, shift), state), _mm_set1_epi32((int)277803737u));
+        return _mm_xor_si128(_mm_srli_epi32(word, 22), word);
+    }
+
+    // PCGHash on 8 lanes
+    PN_TARGET_AVX2 static __m256i PCGHash8(const __m256i &input)
+    {
+        __m256i state = _mm256_add_epi32(_mm256_mullo_epi32(input, _mm256_set1_epi32((int)747796405u)), _mm256_set1_epi32((int)2891336453u));
+        __m256i shift = _mm256_add_epi32(_mm256_srli_epi32(state, 28), _mm256_set1_epi32(4));
+        __m256i word = _mm256_mullo_epi32(_mm256_xor_si256(_mm256_srlv_epi32(state, shift), state), _mm256_set1_epi32((int)277803737u));
+        return _mm256_xor_si256(_mm256_srli_epi32(word, 22), word);
+    }
+
+    // Every sample on a row of Noise2D shares the same Y lattice coordinate and spline
+    struct NoiseRow
+    {
+        uint32_t Hash0;
+        uint32_t Hash1;
+        double Fraction;
+        double Spline;
+    };
+
+    static NoiseRow MakeNoiseRow(const uint32_t &seedHash, const double &y)
+    {
+        double fy = floor(y);
+        int Y = (int)fy;
+        return { HashRow(seedHash, Y), HashRow(seedHash, Y + 1), y - fy, spline(y - fy) };
+    }
+
+    // The row's values broadcast to every lane
+    struct NoiseRow4
+    {
+        __m256d Yf0, Yf1, V;
+        __m128i Row0, Row1;
+    };
+
+    struct NoiseRow8
+    {
+        __m256 Yf0, Yf1, V;
+        __m256i Row0, Row1;
+    };
+
+    PN_TARGET_AVX2 static NoiseRow4 MakeNoiseRow4(const NoiseRow &row)
+    {
+        return { _mm256_set1_pd(row.Fraction), _mm256_set1_pd(row.Fraction - 1.0), _mm256_set1_pd(row.Spline),
+            _mm_set1_epi32((int)row.Hash0), _mm_set1_epi32((int)row.Hash1) };
+    }
+
+    PN_TARGET_AVX2 static NoiseRow8 MakeNoiseRow8(const NoiseRow &row)
+    {
+        return { _mm256_set1_ps((float)row.Fraction), _mm256_set1_ps((float)(row.Fraction - 1.0)), _mm256_set1_ps((float)row.Spline),
+            _mm256_set1_epi32((int)row.Hash0), _mm256_set1_epi32((int)row.Hash1) };
+    }
+
+    // Noise2D of 4 points on a row
+    PN_TARGET_AVX2 static inline __m256d Noise4(const __m256d &xv, const NoiseRow4 &row)
+    {
+        __m128i mask = _mm_set1_epi32(15);
+        __m256d onepd = _mm256_set1_pd(1.0);
+
+        // Find the unit square that contains each point and the relative position within it
+        __m256d fx = _mm256_floor_pd(xv);
+        __m128i X = _mm256_cvttpd_epi32(fx);
+        __m256d xf0 = _mm256_sub_pd(xv, fx);
+        __m256d xf1 = _mm256_sub_pd(xf0, onepd);
+
+        // 6*t^5 - 15*t^4 + 10*t^3
+        __m256d u = _mm256_mul_pd(_mm256_mul_pd(xf0, _mm256_mul_pd(xf0, xf0)),
+            _mm256_add_pd(_mm256_mul_pd(xf0, _mm256_sub_pd(_mm256_mul_pd(xf0, _mm256_set1_pd(6.0)), _mm256_set1_pd(15.0))), _mm256_set1_pd(10.0)));
+
+        // Hash the 4 corners and gather their influence vectors from the direction table
+        __m128i X1 = _mm_add_epi32(X, _mm_set1_epi32(1));
+        __m128i i00 = _mm_and_si128(PCGHash4(_mm_add_epi32(X, row.Row0)), mask);
+        __m128i i10 = _mm_and_si128(PCGHash4(_mm_add_epi32(X1, row.Row0)), mask);
+        __m128i i01 = _mm_and_si128(PCGHash4(_mm_add_epi32(X, row.Row1)), mask);
+        __m128i i11 = _mm_and_si128(PCGHash4(_mm_add_epi32(X1, row.Row1)), mask);
+
+        __m256d d00 = _mm256_add_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientX, i00, 4)), xf0),
+            _mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientY, i00, 4)), row.Yf0));
+        __m256d d10 = _mm256_add_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientX, i10, 4)), xf1),
+            _mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientY, i10, 4)), row.Yf0));
+        __m256d d01 = _mm256_add_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientX, i01, 4)), xf0),
+            _mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientY, i01, 4)), row.Yf1));
+        __m256d d11 = _mm256_add_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientX, i11, 4)), xf1),
+            _mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(GradientY, i11, 4)), row.Yf1));
+
+        // Blend the results for the 4 corners
+        __m256d a = _mm256_add_pd(d00, _mm256_mul_pd(u, _mm256_sub_pd(d10, d00)));
+        __m256d b = _mm256_add_pd(d01, _mm256_mul_pd(u, _mm256_sub_pd(d11, d01)));
+        return _mm256_add_pd(a, _mm256_mul_pd(row.V, _mm256_sub_pd(b, a)));
+    }
+
+    // Noise2D of 8 points on a row in float. The coordinates are split into their lattice cell and fraction in
+    // double, so the float math only sees values in [-1, 1].
+    PN_TARGET_AVX2 static inline __m256 Noise8(const __m256d &xlo, const __m256d &xhi, const NoiseRow8 &row)
+    {
+        __m256i mask = _mm256_set1_epi32(15);
+        __m256 oneps = _mm256_set1_ps(1.0f);
+
+        // Find the unit square that contains each point and the relative position within it
+        __m256d fxlo = _mm256_floor_pd(xlo);
+        __m256d fxhi = _mm256_floor_pd(xhi);
+        __m256i X = _mm256_set_m128i(_mm256_cvttpd_epi32(fxhi), _mm256_cvttpd_epi32(fxlo));
+        __m256 xf0 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(xhi, fxhi)), _mm256_cvtpd_ps(_mm256_sub_pd(xlo, fxlo)));
+        __m256 xf1 = _mm256_sub_ps(xf0, oneps);
+
+        // 6*t^5 - 15*t^4 + 10*t^3
+        __m256 u = _mm256_mul_ps(_mm256_mul_ps(xf0, _mm256_mul_ps(xf0, xf0)),
+            _mm256_add_ps(_mm256_mul_ps(xf0, _mm256_sub_ps(_mm256_mul_ps(xf0, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f)));
+
+        // Hash the 4 corners and gather their influence vectors from the direction table
+        __m256i X1 = _mm256_add_epi32(X, _mm256_set1_epi32(1));
+        __m256i i00 = _mm256_and_si256(PCGHash8(_mm256_add_epi32(X, row.Row0)), mask);
+        __m256i i10 = _mm256_and_si256(PCGHash8(_mm256_add_epi32(X1, row.Row0)), mask);
+        __m256i i01 = _mm256_and_si256(PCGHash8(_mm256_add_epi32(X, row.Row1)), mask);
+        __m256i i11 = _mm256_and_si256(PCGHash8(_mm256_add_epi32(X1, row.Row1)), mask);
+
+        __m256 d00 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(GradientX, i00, 4), xf0),
+            _mm256_mul_ps(_mm256_i32gather_ps(GradientY, i00, 4), row.Yf0));
+        __m256 d10 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(GradientX, i10, 4), xf1),
+            _mm256_mul_ps(_mm256_i32gather_ps(GradientY, i10, 4), row.Yf0));
+        __m256 d01 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(GradientX, i01, 4), xf0),
+            _mm256_mul_ps(_mm256_i32gather_ps(GradientY, i01, 4), row.Yf1));
+        __m256 d11 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(GradientX, i11, 4), xf1),
+            _mm256_mul_ps(_mm256_i32gather_ps(GradientY, i11, 4), row.Yf1));
+
+        // Blend the results for the 4 corners
+        __m256 a = _mm256_add_ps(d00, _mm256_mul_ps(u, _mm256_sub_ps(d10, d00)));
+        __m256 b = _mm256_add_ps(d01, _mm256_mul_ps(u, _mm256_sub_ps(d11, d01)));
+        return _mm256_add_ps(a, _mm256_mul_ps(row.V, _mm256_sub_ps(b, a)));
+    }
+
+    // Evaluates 4 Noise2D samples per iteration, count must be a multiple of 4
+    PN_TARGET_AVX2 static void Noise2DRowAVX2(const uint32_t &seedHash, const double *x, const double &y, double *out, const size_t &count)
+    {
+        NoiseRow4 row = MakeNoiseRow4(MakeNoiseRow(seedHash, y));
+        for (size_t i = 0; i < count; i += 4)
+            _mm256_storeu_pd(out + i, Noise4(_mm256_loadu_pd(x + i), row));
+    }
+
+    // Evaluates 8 Noise2D samples per iteration in float, count must be a multiple of 8
+    PN_TARGET_AVX2 static void Noise2DRowAVX2(const uint32_t &seedHash, const double *x, const double &y, float *out, const size_t &count)
+    {
+        NoiseRow8 row = MakeNoiseRow8(MakeNoiseRow(seedHash, y));
+        for (size_t i = 0; i < count; i += 8)
+            _mm256_storeu_ps(out + i, Noise8(_mm256_loadu_pd(x + i), _mm256_loadu_pd(x + i + 4), row));
+    }
+
+    // Sums Levels octaves of 4 samples in registers, count must be a multiple of 4. The rows of every level
+    // are set up once, and the coordinates are computed the same way as the generic loop so results match it.
+    template<int Levels>
+    PN_TARGET_AVX2 static void OctaveNoise2DRowAVX2(const uint32_t &seedHash, const int &x, const int &y, const double &cellsize,
+        const double *amplitude, const double &amplified, double *out, const size_t &count)
+    {
+        NoiseRow4 rows[Levels];
+        double Y = (double)y / cellsize;
+        for (int level = 0; level < Levels; level++, Y *= 2.0)
+            rows[level] = MakeNoiseRow4(MakeNoiseRow(seedHash, Y));
+
+        __m256d offsets = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+        __m256d cell = _mm256_set1_pd(cellsize);
+        __m256d two = _mm256_set1_pd(2.0);
+        __m256d total = _mm256_set1_pd(amplified);
+
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m256d xv = _mm256_div_pd(_mm256_add_pd(_mm256_set1_pd((double)(x + (int)i)), offsets), cell);
+            __m256d sum = _mm256_setzero_pd();
+            for (int level = 0; level < Levels; level++)
+            {
+                sum = _mm256_add_pd(sum, _mm256_mul_pd(Noise4(xv, rows[level]), _mm256_set1_pd(amplitude[level])));
+                xv = _mm256_mul_pd(xv, two);
+            }
+            _mm256_storeu_pd(out + i, _mm256_div_pd(sum, total));
+        }
+    }
+
+    // Same as above for 8 samples in float, count must be a multiple of 8
+    template<int Levels>
+    PN_TARGET_AVX2 static void OctaveNoise2DRowAVX2(const uint32_t &seedHash, const int &x, const int &y, const double &cellsize,
+        const float *amplitude, const float &amplified, float *out, const size_t &count)
     {
-        for (float x = cellsize; x < gridsize.x; x += cellsize)
-            drawlist->AddLine(ImVec2(p0.x + x, p0.y + cellsize), ImVec2(p0.x + x, p1.y - cellsize), linecolor);
-        for (float y = cellsize; y < gridsize.y; y += cellsize)
-            drawlist->AddLine(ImVec2(p0.x + cellsize, p0.y + y), ImVec2(p1.x - cellsize, p0.y + y), linecolor);
+        NoiseRow8 rows[Levels];
+        double Y = (double)y / cellsize;
+        for (int level = 0; level < Levels; level++, Y *= 2.0)
+            rows[level] = MakeNoiseRow8(MakeNoiseRow(seedHash, Y));
+
+        __m256d offsetslo = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+        __m256d offsetshi = _mm256_set_pd(7.0, 6.0, 5.0, 4.0);
+        __m256d cell = _mm256_set1_pd(cellsize);
+        __m256d two = _mm256_set1_pd(2.0);
+        __m256 total = _mm256_set1_ps(amplified);
+
+        for (size_t i = 0; i < count; i += 8)
+        {
+            __m256d first = _mm256_set1_pd((double)(x + (int)i));
+            __m256d xlo = _mm256_div_pd(_mm256_add_pd(first, offsetslo), cell);
+            __m256d xhi = _mm256_div_pd(_mm256_add_pd(first, offsetshi), cell);
+            __m256 sum = _mm256_setzero_ps();
+            for (int level = 0; level < Levels; level++)
+            {
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(Noise8(xlo, xhi, rows[level]), _mm256_set1_ps(amplitude[level])));
+                xlo = _mm256_mul_pd(xlo, two);
+                xhi = _mm256_mul_pd(xhi, two);
+            }
+            _mm256_storeu_ps(out + i, _mm256_div_ps(sum, total));
+        }
     }
+
+    // Every sample on a row of Noise3D or Noise4D shares its lattice cell along every axis but X. Corner rows are
+    // numbered by their offsets along Y, Z and W, one bit per axis, the way Noise4D numbers them.
+    template<int Dims>
+    struct NoiseRowND
+    {
+        static constexpr int Axes = Dims - 1;
+        static constexpr int Rows = 1 << Axes;
+        __m128i Hash[Rows];
+        __m256d Offset[Axes][2];
+        __m256d Spline[Axes];
+    };
+
+    // coords holds the row's Y, Z and W, hashed the same way Noise3D and Noise4D hash them
+    template<int Dims>
+    PN_TARGET_AVX2 static NoiseRowND<Dims> MakeNoiseRowND(const uint32_t &seedHash, const double *coords)
+    {
+        NoiseRowND<Dims> row;
+        int lattice[NoiseRowND<Dims>::Axes];
+        for (int axis = 0; axis < NoiseRowND<Dims>::Axes; axis++)
+        {
+            double fc = floor(coords[axis]);
+            lattice[axis] = (int)fc;
+            row.Offset[axis][0] = _mm256_set1_pd(coords[axis] - fc);
+            row.Offset[axis][1] = _mm256_set1_pd(coords[axis] - fc - 1.0);
+            row.Spline[axis] = _mm256_set1_pd(spline(coords[axis] - fc));
+        }
+
+        // The last axis is hashed first, each one below it folds its coordinate into the hash
+        for (int corner = 0; corner < NoiseRowND<Dims>::Rows; corner++)
+        {
+            uint32_t hash = seedHash;
+            for (int axis = NoiseRowND<Dims>::Axes - 1; axis >= 0; axis--)
+                hash = HashRow(hash, lattice[axis] + ((corner >> axis) & 1));
+            row.Hash[corner] = _mm_set1_epi32((int)hash);
+        }
+        return row;
+    }
+
+    // Noise3D or Noise4D of 4 points on a row, summing and blending in the same order as the scalar versions
+    template<int Dims>
+    PN_TARGET_AVX2 static inline __m256d NoiseND4(const __m256d &xv, const NoiseRowND<Dims> &row)
+    {
+        const float *gradients = Dims == 3 ? &Gradient3D[0][0] : &Gradient4D[0][0];
+        __m128i mask = _mm_set1_epi32(Dims == 3 ? 15 : 31);
+        __m128i stride = _mm_set1_epi32(Dims);
+
+        // Find the unit cell that contains each point and the relative position within it
+        __m256d fx = _mm256_floor_pd(xv);
+        __m128i X[2] = { _mm256_cvttpd_epi32(fx), _mm_add_epi32(_mm256_cvttpd_epi32(fx), _mm_set1_epi32(1)) };
+        __m256d xf[2] = { _mm256_sub_pd(xv, fx), _mm256_sub_pd(_mm256_sub_pd(xv, fx), _mm256_set1_pd(1.0)) };
+
+        // 6*t^5 - 15*t^4 + 10*t^3
+        __m256d u = _mm256_mul_pd(_mm256_mul_pd(xf[0], _mm256_mul_pd(xf[0], xf[0])),
+            _mm256_add_pd(_mm256_mul_pd(xf[0], _mm256_sub_pd(_mm256_mul_pd(xf[0], _mm256_set1_pd(6.0)), _mm256_set1_pd(15.0))), _mm256_set1_pd(10.0)));
+
+        // Dot the offset to both corners of every row with their gradient and blend them along X
+        __m256d values[NoiseRowND<Dims>::Rows];
+        for (int corner = 0; corner < NoiseRowND<Dims>::Rows; corner++)
+        {
+            __m256d dots[2];
+            for (int side = 0; side < 2; side++)
+            {
+                __m128i index = _mm_mullo_epi32(_mm_and_si128(PCGHash4(_mm_add_epi32(X[side], row.Hash[corner])), mask), stride);
+                __m256d dot = _mm256_mul_pd(_mm256_cvtps_pd(_mm_i32gather_ps(gradients, index, 4)), xf[side]);
+                for (int axis = 0; axis < NoiseRowND<Dims>::Axes; axis++)
+                {
+                    __m256d component = _mm256_cvtps_pd(_mm_i32gather_ps(gradients + axis + 1, index, 4));
+                    dot = _mm256_add_pd(dot, _mm256_mul_pd(component, row.Offset[axis][(corner >> axis) & 1]));
+                }
+                dots[side] = dot;
+            }
+            values[corner] = _mm256_add_pd(dots[0], _mm256_mul_pd(u, _mm256_sub_pd(dots[1], dots[0])));
+        }
+
+        // Blend pairs of rows along Y, then Z, then W
+        int count = NoiseRowND<Dims>::Rows;
+        for (int axis = 0; axis < NoiseRowND<Dims>::Axes; axis++)
+        {
+            count /= 2;
+            for (int i = 0; i < count; i++)
+                values[i] = _mm256_add_pd(values[2 * i], _mm256_mul_pd(row.Spline[axis], _mm256_sub_pd(values[2 * i + 1], values[2 * i])));
+        }
+        return _mm256_mul_pd(values[0], _mm256_set1_pd(Dims == 3 ? Noise3DScale : Noise4DScale));
+    }
+
+    // Evaluates 4 Noise3D or Noise4D samples per iteration, count must be a multiple of 4
+    template<int Dims>
+    PN_TARGET_AVX2 static void NoiseNDRowAVX2(const uint32_t &seedHash, const double *x, const double *coords, double *out, const size_t &count)
+    {
+        NoiseRowND<Dims> row = MakeNoiseRowND<Dims>(seedHash, coords);
+        for (size_t i = 0; i < count; i += 4)
+            _mm256_storeu_pd(out + i, NoiseND4<Dims>(_mm256_loadu_pd(x + i), row));
+    }
+
+    // Height map preview colors as 0xAABBGGRR, the same layout as IM_COL32
+    static constexpr ShadingPalette::TerrainColors PreviewColors = { 0xffc44020, 0xff4bb4b4, 0xff80c488, 0xff333333, 0xffffffff };
+
+#ifdef PN_PREVIEW_SIMD
+    // Scales 4 heights to palette levels, clamped to [0, maxLevel] and truncated like casting each of them to int
+    static __m128i HeightsToLevels4(const double *heights, const __m128d &maxLevel)
+    {
+        __m128d zero = _mm_setzero_pd();
+        __m128d lo = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(heights), maxLevel), zero), maxLevel);
+        __m128d hi = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(heights + 2), maxLevel), zero), maxLevel);
+        return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+    }
+#endif
+
+#ifndef PN_HEADLESS
+    // Blends color over pixel by its alpha, the result stays opaque
+    static void BlendPixel(uint32_t &pixel, const uint32_t &color)
+    {
+        uint32_t alpha = color >> 24;
+        uint32_t blended = 0xff000000;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t source = (color >> shift) & 0xff;
+            uint32_t target = (pixel >> shift) & 0xff;
+            blended |= ((source * alpha + target * (255 - alpha) + 127) / 255) << shift;
+        }
+        pixel = blended;
+    }
+
+    // Draws a one pixel wide line, pixels outside the image are skipped
+    static void DrawLine(std::vector<uint32_t> &pixels, const int &width, const int &height, const glm::vec2 &from, const glm::vec2 &to, const uint32_t &color)
+    {
+        glm::vec2 delta = to - from;
+        int steps = std::max((int)std::ceil(std::max(std::abs(delta.x), std::abs(delta.y))), 1);
+        for (int step = 0; step <= steps; step++)
+        {
+            glm::vec2 point = from + delta * ((float)step / (float)steps);
+            int x = (int)std::floor(point.x);
+            int y = (int)std::floor(point.y);
+            if (x >= 0 && y >= 0 && x < width && y < height)
+                BlendPixel(pixels[x + (size_t)y * width], color);
+        }
+    }
+
+    // Uploads pixels to image, creating or resizing it first if needed
+    static void UploadImage(std::shared_ptr<Walnut::Image> &image, const uint32_t &width, const uint32_t &height, const std::vector<uint32_t> &pixels)
+    {
+        if (!image)
+            image = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+        else if (image->GetWidth() != width || image->GetHeight() != height)
+            image->Resize(width, height);
+
+        image->SetData(pixels.data());
+    }
+#endif
 }
 
+#ifndef PN_HEADLESS
 bool PerlinNoiseGenerator::GUI(size_t &width, size_t &height)
 {
     ImGuiWindowFlags canvas_window_flags = ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_AlwaysAutoResize;
@@ -34,33 +497,21 @@ bool PerlinNoiseGenerator::GUI(size_t &width, size_t &height)
     {
         ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));      // Disable padding
         ImGui::PushStyleColor(ImGuiCol_ChildBg, IM_COL32(50, 50, 50, 255));  // Set a background color
-        if (ImGui::BeginChild("Grid", ImVec2((m_Width * m_Levels) + 2 * m_CellSize, (m_Height * m_Levels) + 2 * m_CellSize), true, ImGuiWindowFlags_NoMove));
-        {
-            // Using InvisibleButton() as a convenience 1) it will advance the layout cursor and 2) allows us to use IsItemHovered()/IsItemActive()
-            ImVec2 canvas_p0 = ImGui::GetCursorScreenPos();      // ImDrawList API uses screen coordinates!
-            ImVec2 canvas_sz = ImGui::GetContentRegionAvail();   // Resize canvas to what's available
-            if (canvas_sz.x < 50.0f) canvas_sz.x = 50.0f;
-            if (canvas_sz.y < 50.0f) canvas_sz.y = 50.0f;
-            ImVec2 canvas_p1 = ImVec2(canvas_p0.x + canvas_sz.x, canvas_p0.y + canvas_sz.y);
-
-            // Draw border and background color
-            ImGuiIO &canvasio = ImGui::GetIO();
-            ImDrawList *draw_list = ImGui::GetWindowDrawList();
-            draw_list->AddRectFilled(canvas_p0, canvas_p1, IM_COL32(50, 50, 50, 255));
-            draw_list->AddRect(canvas_p0, canvas_p1, IM_COL32(255, 255, 255, 255));
-
-            // Draw grid + all lines in the canvas
-            draw_list->PushClipRect(canvas_p0, canvas_p1, true);
+        // Grids that do not fit the texture size limit are drawn scaled down to it
+        float gridwidth = (float)((m_Width * m_Levels) + 2 * m_CellSize);
+        float gridheight = (float)((m_Height * m_Levels) + 2 * m_CellSize);
+        float gridscale = std::min(1.0f, (float)MaxInfluenceImageSize / std::max(gridwidth, gridheight));
+        uint32_t imagewidth = std::max((uint32_t)(gridwidth * gridscale), 1u);
+        uint32_t imageheight = std::max((uint32_t)(gridheight * gridscale), 1u);
 
-
-            // Draw the grid
-            ImU32 linecolor = IM_COL32(200, 200, 200, 40);
-            Utils::DrawGrid(draw_list, canvas_p0, canvas_p1, canvas_sz, m_CellSize, linecolor);
-
-            // Draw the influence vectors
-            DrawInfluenceVectors(draw_list, canvas_p0);
-
-            draw_list->PopClipRect();
+        if (ImGui::BeginChild("Grid", ImVec2((float)imagewidth, (float)imageheight), true, ImGuiWindowFlags_NoMove));
+        {
+            // The grid and influence vectors are drawn into a texture once per parameter change, unless they are being regenerated
+            if (!m_Generating)
+            {
+                UpdateInfluenceImage(imagewidth, imageheight, gridscale);
+                ImGui::Image(m_InfluenceImage->GetDescriptorSet(), ImVec2((float)imagewidth, (float)imageheight));
+            }
         }
         ImGui::PopStyleColor();
         ImGui::PopStyleVar();
@@ -75,6 +526,19 @@ bool PerlinNoiseGenerator::GUI(size_t &width, size_t &height)
     static int tempLevels = m_Levels;
     static double tempAttenuation = m_Attenuation;
 
+    // The fields follow parameters set from anywhere else, such as a loaded scene
+    static uint64_t tempVersion = m_ParametersVersion;
+    if (tempVersion != m_ParametersVersion)
+    {
+        tempSeed = m_Seed;
+        tempWidth = m_Width;
+        tempHeight = m_Height;
+        tempCellSize = m_CellSize;
+        tempLevels = m_Levels;
+        tempAttenuation = m_Attenuation;
+        tempVersion = m_ParametersVersion;
+    }
+
     bool updated = false;
 
     // Settings Menu
@@ -134,26 +598,24 @@ bool PerlinNoiseGenerator::GUI(size_t &width, size_t &height)
         // Add a blank space
         ImGui::Dummy(ImVec2(0.0f, 10.0f));
 
-        // If we click the generate button, update our member variables, influence vectors, and pixel data
-        if (ImGui::Button("Generate Noise"))
+        // If we click the generate button, update our member variables, influence vectors, and pixel data in the background.
+        // Animation frames share the pixel data, so they are discarded first and resume from the new map.
+        if (ImGui::Button("Generate Noise") && !m_Generating)
         {
-            updated = true;
+            DiscardFrames();
+            GenerateAsync(tempSeed, tempWidth, tempHeight, tempCellSize, tempLevels, tempAttenuation);
+        }
 
-            m_Seed = tempSeed;
-            m_Height = tempHeight;
-            m_Width = tempWidth;
-            m_CellSize = tempCellSize;
-            m_Levels = tempLevels;
-            m_Attenuation = tempAttenuation;
+        if (m_Generating)
+            ImGui::ProgressBar(GetProgress());
+
+        // Once the background generation has finished, let the scene know about the new noise
+        if (m_Generated.exchange(false))
+        {
+            updated = true;
 
             width = (size_t)m_Width;
             height = (size_t)m_Height;
-
-            //m_RandomEngine.seed(tempSeed);
-            srand(tempSeed);
-
-            UpdateInfluenceVectors();
-            UpdatePixelData();
         }
     }
     // End the settings panel
@@ -167,25 +629,12 @@ bool PerlinNoiseGenerator::GUI(size_t &width, size_t &height)
         ImGui::PushStyleColor(ImGuiCol_ChildBg, IM_COL32(50, 50, 50, 255));  // Set a background color
         if (ImGui::BeginChild("noiseheightmap", ImVec2(m_Width, m_Height), true, ImGuiWindowFlags_NoMove));
         {
-            // Using InvisibleButton() as a convenience 1) it will advance the layout cursor and 2) allows us to use IsItemHovered()/IsItemActive()
-            ImVec2 canvas_p0 = ImGui::GetCursorScreenPos();      // ImDrawList API uses screen coordinates!
-            ImVec2 canvas_sz = ImGui::GetContentRegionAvail();   // Resize canvas to what's available
-            if (canvas_sz.x < 50.0f) canvas_sz.x = 50.0f;
-            if (canvas_sz.y < 50.0f) canvas_sz.y = 50.0f;
-            ImVec2 canvas_p1 = ImVec2(canvas_p0.x + canvas_sz.x, canvas_p0.y + canvas_sz.y);
-
-            // Draw border and background color
-            ImGuiIO &canvasio = ImGui::GetIO();
-            ImDrawList *draw_list = ImGui::GetWindowDrawList();
-            draw_list->AddRectFilled(canvas_p0, canvas_p1, IM_COL32(50, 50, 50, 255));
-            draw_list->AddRect(canvas_p0, canvas_p1, IM_COL32(255, 255, 255, 255));
-
-            // Draw grid + all lines in the canvas
-            draw_list->PushClipRect(canvas_p0, canvas_p1, true);
-
-            // Draw the height map
-            DrawNoiseHeightMap(draw_list, canvas_p0);
-            draw_list->PopClipRect();
+            // The height map is converted and uploaded only when the noise or its shading changes, unless it is being regenerated
+            if (!m_Generating)
+            {
+                UpdateHeightMapImage();
+                ImGui::Image(m_HeightMapImage->GetDescriptorSet(), ImVec2((float)m_Width, (float)m_Height));
+            }
         }
         ImGui::PopStyleColor();
         ImGui::PopStyleVar();
@@ -196,14 +645,153 @@ bool PerlinNoiseGenerator::GUI(size_t &width, size_t &height)
     // If we updated out variables, return it
     return updated;
 }
+#endif
+
+void PerlinNoiseGenerator::Generate(const int &seed, const int &width, const int &height,
+    const int &cellsize, const int &levels, const double &attenuation)
+{
+    if (IsCurrent(seed, width, height, cellsize, levels, attenuation))
+        return;
+
+    SetParameters(seed, width, height, cellsize, levels, attenuation);
+    UpdateNoise();
+}
+
+void PerlinNoiseGenerator::GenerateAsync(const int &seed, const int &width, const int &height,
+    const int &cellsize, const int &levels, const double &attenuation)
+{
+    // Nothing to generate, but the caller still gets told the noise is ready
+    if (IsCurrent(seed, width, height, cellsize, levels, attenuation))
+    {
+        m_Generated = true;
+        return;
+    }
+
+    // The parameters are set on the calling thread so the GUI can keep reading them during generation
+    SetParameters(seed, width, height, cellsize, levels, attenuation);
+    m_Generating = true;
+
+    ThreadPool::Get().Submit([this]()
+        {
+            UpdateNoise();
+            m_Generated = true;
+            m_Generating = false;
+        });
+}
+
+void PerlinNoiseGenerator::GenerateFrame(const double &time)
+{
+    UpdateFrameData(time, m_AnimationLoop);
+    m_FrameReady = true;
+    SwapFrame();
+}
+
+bool PerlinNoiseGenerator::GenerateFrameAsync(const double &time)
+{
+    // A finished frame that has not been swapped in yet still owns the back buffer
+    if (m_Generating || m_FrameGenerating || m_FrameReady)
+        return false;
+
+    m_FrameGenerating = true;
+    ThreadPool::Get().Submit([this, time, loopPeriod = m_AnimationLoop]()
+        {
+            UpdateFrameData(time, loopPeriod);
+            m_FrameReady = true;
+            m_FrameGenerating = false;
+        });
+    return true;
+}
+
+bool PerlinNoiseGenerator::SwapFrame()
+{
+    if (m_Generating || !m_FrameReady.exchange(false))
+        return false;
+
+    std::swap(m_PixelData, m_FrameData);
+    m_Animated = true;
+    m_Version++;
+    return true;
+}
+
+void PerlinNoiseGenerator::DiscardFrames()
+{
+    while (m_FrameGenerating)
+        std::this_thread::yield();
+    m_FrameReady = false;
+}
+
+void PerlinNoiseGenerator::Wait() const
+{
+    while (m_Generating || m_FrameGenerating)
+        std::this_thread::yield();
+}
+
+void PerlinNoiseGenerator::UseNoise(const int &seed, const int &width, const int &height, const int &cellsize, const int &levels,
+    const double &attenuation, const std::vector<double> &noise)
+{
+    DiscardFrames();
+    Wait();
+
+    SetParameters(seed, width, height, cellsize, levels, attenuation);
+    m_PixelData = noise;
+    m_Generated = false;
+    m_Animated = false;
+    m_Version++;
+}
+
+void PerlinNoiseGenerator::StopAnimation()
+{
+    DiscardFrames();
+
+    // A generation that is already running replaces the frame anyway
+    if (m_Animated && !m_Generating)
+        GenerateAsync(m_Seed, m_Width, m_Height, m_CellSize, m_Levels, m_Attenuation);
+}
+
+void PerlinNoiseGenerator::SetParameters(const int &seed, const int &width, const int &height,
+    const int &cellsize, const int &levels, const double &attenuation)
+{
+    m_Seed = seed;
+    m_Width = width;
+    m_Height = height;
+    m_CellSize = cellsize;
+    m_Levels = levels;
+    m_Attenuation = attenuation;
+    m_SeedHash = HashSeed(seed);
+    m_ParametersVersion++;
+}
+
+bool PerlinNoiseGenerator::IsCurrent(const int &seed, const int &width, const int &height,
+    const int &cellsize, const int &levels, const double &attenuation) const
+{
+    return !m_Generating && !m_Animated && m_Version > 0 && m_Seed == seed && m_Width == width && m_Height == height &&
+        m_CellSize == cellsize && m_Levels == levels && m_Attenuation == attenuation;
+}
+
+uint32_t PerlinNoiseGenerator::HashSeed(const int &seed)
+{
+    return Utils::PCGHash((uint32_t)seed);
+}
+
+glm::vec2 PerlinNoiseGenerator::GetInfluenceVector(const int &x, const int &y) const
+{
+    return Utils::Gradient(Utils::HashRow(m_SeedHash, y), x);
+}
+
+void PerlinNoiseGenerator::UpdateNoise()
+{
+    UpdatePixelData();
+    m_Animated = false;
+    m_Version++;
+}
 
 // Adapted code from Ken Perlin's java implemenation of his Improved Perlin Noise Algorith
 // Found at https://cs.nyu.edu/~perlin/noise/
-double PerlinNoiseGenerator::Noise2D(double x, double y)
+// The permutation table lookups are replaced by hashing the lattice coordinates with the seed
+double PerlinNoiseGenerator::Noise2D(double x, double y) const
 {
-    uint16_t maxLength = std::max(m_Width, m_Height) - 1;
-    int X = (int)floor(x) & maxLength; // FIND UNIT SQUARE THAT
-    int Y = (int)floor(y) & maxLength; // CONTAINS POINT.
+    int X = (int)floor(x); // FIND UNIT SQUARE THAT
+    int Y = (int)floor(y); // CONTAINS POINT.
 
     x -= floor(x); // FIND RELATIVE X,Y
     y -= floor(y); // OF POINT IN CUBE.
@@ -211,13 +799,88 @@ double PerlinNoiseGenerator::Noise2D(double x, double y)
     double u = Utils::spline(x); // COMPUTE SPLINE CURVES
     double v = Utils::spline(y); // FOR EACH OF X,Y.
 
-    return Utils::lerp(v, Utils::lerp(u, glm::dot(m_InfluenceVectors[X + Y * m_Width], glm::vec2(x,y)),// AND ADD
-        glm::dot(m_InfluenceVectors[(X + 1) + Y * m_Width], glm::vec2(x-1.0,y))),                      // BLENDED
-        Utils::lerp(u, glm::dot(m_InfluenceVectors[X + (Y + 1) * m_Width], glm::vec2(x,y-1.0)),        // RESULTS
-            glm::dot(m_InfluenceVectors[(X + 1) + (Y + 1) * m_Width], glm::vec2(x-1.0,y-1.0))));       // FOR 4 CORNERS
+    uint32_t row0 = Utils::HashRow(m_SeedHash, Y);     // HASH COORDINATES OF
+    uint32_t row1 = Utils::HashRow(m_SeedHash, Y + 1); // THE 4 SQUARE CORNERS
+
+    return Utils::lerp(v, Utils::lerp(u, glm::dot(Utils::Gradient(row0, X), glm::vec2(x,y)),// AND ADD
+        glm::dot(Utils::Gradient(row0, X + 1), glm::vec2(x-1.0,y))),                       // BLENDED
+        Utils::lerp(u, glm::dot(Utils::Gradient(row1, X), glm::vec2(x,y-1.0)),             // RESULTS
+            glm::dot(Utils::Gradient(row1, X + 1), glm::vec2(x-1.0,y-1.0))));              // FOR 4 CORNERS
+}
+
+// Noise2D with one more axis. Each extra lattice coordinate is folded into the row hash the same way Y is.
+double PerlinNoiseGenerator::Noise3D(double x, double y, double z) const
+{
+    int X = (int)floor(x);
+    int Y = (int)floor(y);
+    int Z = (int)floor(z);
+
+    x -= floor(x);
+    y -= floor(y);
+    z -= floor(z);
+
+    double u = Utils::spline(x);
+    double v = Utils::spline(y);
+    double w = Utils::spline(z);
+
+    // Hash the 4 rows of the unit cube, every row then only needs one more hash per corner
+    uint32_t plane0 = Utils::HashRow(m_SeedHash, Z);
+    uint32_t plane1 = Utils::HashRow(m_SeedHash, Z + 1);
+    uint32_t row00 = Utils::HashRow(plane0, Y);
+    uint32_t row10 = Utils::HashRow(plane0, Y + 1);
+    uint32_t row01 = Utils::HashRow(plane1, Y);
+    uint32_t row11 = Utils::HashRow(plane1, Y + 1);
+
+    double front = Utils::lerp(v,
+        Utils::lerp(u, Utils::Gradient3(row00, X, x, y, z), Utils::Gradient3(row00, X + 1, x - 1.0, y, z)),
+        Utils::lerp(u, Utils::Gradient3(row10, X, x, y - 1.0, z), Utils::Gradient3(row10, X + 1, x - 1.0, y - 1.0, z)));
+    double back = Utils::lerp(v,
+        Utils::lerp(u, Utils::Gradient3(row01, X, x, y, z - 1.0), Utils::Gradient3(row01, X + 1, x - 1.0, y, z - 1.0)),
+        Utils::lerp(u, Utils::Gradient3(row11, X, x, y - 1.0, z - 1.0), Utils::Gradient3(row11, X + 1, x - 1.0, y - 1.0, z - 1.0)));
+
+    return Utils::lerp(w, front, back) * Utils::Noise3DScale;
 }
 
-double PerlinNoiseGenerator::OctaveNoise2D(const int &x, const int &y)
+double PerlinNoiseGenerator::Noise4D(double x, double y, double z, double w) const
+{
+    int X = (int)floor(x);
+    int Y = (int)floor(y);
+    int Z = (int)floor(z);
+    int W = (int)floor(w);
+
+    x -= floor(x);
+    y -= floor(y);
+    z -= floor(z);
+    w -= floor(w);
+
+    double u = Utils::spline(x);
+    double v = Utils::spline(y);
+    double s = Utils::spline(z);
+    double t = Utils::spline(w);
+
+    // Blend the 8 rows of the unit hypercube, the bits of corner are its offsets along Y, Z and W
+    double rows[8];
+    for (int dw = 0; dw < 2; dw++)
+    {
+        uint32_t volume = Utils::HashRow(m_SeedHash, W + dw);
+        for (int dz = 0; dz < 2; dz++)
+        {
+            uint32_t plane = Utils::HashRow(volume, Z + dz);
+            for (int dy = 0; dy < 2; dy++)
+            {
+                uint32_t row = Utils::HashRow(plane, Y + dy);
+                rows[dy + dz * 2 + dw * 4] = Utils::lerp(u, Utils::Gradient4(row, X, x, y - dy, z - dz, w - dw),
+                    Utils::Gradient4(row, X + 1, x - 1.0, y - dy, z - dz, w - dw));
+            }
+        }
+    }
+
+    double front = Utils::lerp(s, Utils::lerp(v, rows[0], rows[1]), Utils::lerp(v, rows[2], rows[3]));
+    double back = Utils::lerp(s, Utils::lerp(v, rows[4], rows[5]), Utils::lerp(v, rows[6], rows[7]));
+    return Utils::lerp(t, front, back) * Utils::Noise4DScale;
+}
+
+double PerlinNoiseGenerator::OctaveNoise2D(const int &x, const int &y) const
 {
     // Loop over each level and generate the noise with a doubled frequency
     double X = (double)x / (double)m_CellSize;
@@ -242,40 +905,168 @@ double PerlinNoiseGenerator::OctaveNoise2D(const int &x, const int &y)
     return result/amplified;
 }
 
-void PerlinNoiseGenerator::UpdateInfluenceVectors()
+template<typename T>
+void PerlinNoiseGenerator::Noise2DRow(const double *x, const double &y, T *out, const size_t &count) const
+{
+    // An AVX2 register holds 4 doubles or 8 floats
+    constexpr size_t lanes = 32 / sizeof(T);
+
+    size_t batched = 0;
+    if (Utils::HasAVX2)
+    {
+        batched = count & ~(lanes - 1);
+        Utils::Noise2DRowAVX2(m_SeedHash, x, y, out, batched);
+    }
+
+    // Scalar fallback for the remainder of the row
+    for (size_t i = batched; i < count; i++)
+        out[i] = (T)Noise2D(x[i], y);
+}
+
+template void PerlinNoiseGenerator::Noise2DRow<double>(const double *, const double &, double *, const size_t &) const;
+template void PerlinNoiseGenerator::Noise2DRow<float>(const double *, const double &, float *, const size_t &) const;
+
+void PerlinNoiseGenerator::Noise3DRow(const double *x, const double &y, const double &z, double *out, const size_t &count) const
 {
-    // Resize and repopulate the influence vectors
-    size_t wdth = (size_t)m_Width * (size_t)m_Levels;
-    size_t hght = (size_t)m_Height * (size_t)m_Levels;
-    m_InfluenceVectors.resize(wdth * hght);
-    float trash = rand(); // If this is not here, the first influence vector is always 0 so call rand() once
+    size_t batched = 0;
+    if (Utils::HasAVX2)
+    {
+        double coords[2] = { y, z };
+        batched = count & ~(size_t)3;
+        Utils::NoiseNDRowAVX2<3>(m_SeedHash, x, coords, out, batched);
+    }
 
-    for (size_t j = 0; j < hght; j++)
+    for (size_t i = batched; i < count; i++)
+        out[i] = Noise3D(x[i], y, z);
+}
+
+void PerlinNoiseGenerator::Noise4DRow(const double *x, const double &y, const double &z, const double &w, double *out, const size_t &count) const
+{
+    size_t batched = 0;
+    if (Utils::HasAVX2)
     {
-        for (size_t i = 0; i < wdth; i++)
+        double coords[3] = { y, z, w };
+        batched = count & ~(size_t)3;
+        Utils::NoiseNDRowAVX2<4>(m_SeedHash, x, coords, out, batched);
+    }
+
+    for (size_t i = batched; i < count; i++)
+        out[i] = Noise4D(x[i], y, z, w);
+}
+
+template<typename T>
+void PerlinNoiseGenerator::OctaveNoise2DRow(const int &x, const int &y, T *out, const size_t &count) const
+{
+    OctaveKernel<T> kernel = GetOctaveKernel<T>();
+    if (kernel)
+        (this->*kernel)(x, y, out, count, GetOctaveTable<T>());
+    else
+        OctaveNoise2DRowGeneric(x, y, out, count);
+}
+
+template void PerlinNoiseGenerator::OctaveNoise2DRow<double>(const int &, const int &, double *, const size_t &) const;
+template void PerlinNoiseGenerator::OctaveNoise2DRow<float>(const int &, const int &, float *, const size_t &) const;
+
+template<typename T>
+void PerlinNoiseGenerator::OctaveNoise2DRowGeneric(const int &x, const int &y, T *out, const size_t &count) const
+{
+    std::vector<double> X(count);
+    std::vector<T> noise(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        X[i] = (double)(x + (int)i) / (double)m_CellSize;
+        out[i] = 0;
+    }
+    double Y = (double)y / (double)m_CellSize;
+
+    T amplifier = 1;
+    T amplified = 0;
+
+    for (int level = 0; level < m_Levels; level++)
+    {
+        // Add the scaled down noise to our current noise
+        Noise2DRow(X.data(), Y, noise.data(), count);
+        for (size_t i = 0; i < count; i++)
         {
-            double angle = 2 * std::_Pi * (double)rand() / RAND_MAX;
-            m_InfluenceVectors[i + j * wdth] = glm::vec2(cos(angle), sin(angle));
+            out[i] += noise[i] * amplifier;
+            X[i] *= 2.0;
         }
+        Y *= 2.0;
+
+        amplified += amplifier;
+        amplifier *= (T)m_Attenuation;
     }
+
+    // Divide the noise by the total amplification we had for all levels
+    for (size_t i = 0; i < count; i++)
+        out[i] /= amplified;
 }
 
-void PerlinNoiseGenerator::DrawInfluenceVectors(ImDrawList *drawlist, const ImVec2 &p0)
+template void PerlinNoiseGenerator::OctaveNoise2DRowGeneric<double>(const int &, const int &, double *, const size_t &) const;
+template void PerlinNoiseGenerator::OctaveNoise2DRowGeneric<float>(const int &, const int &, float *, const size_t &) const;
+
+template<typename T>
+PerlinNoiseGenerator::OctaveTable<T> PerlinNoiseGenerator::GetOctaveTable() const
 {
-    // Add 1 to rows/cols because we need n + 1 influence vectors for n cells (for 1 cell we need 4 influence vectors, 2 in x and 2 in y)
-    size_t rows = 1 + ((size_t)m_Height * (size_t)m_Levels) / (size_t)m_CellSize;
-    size_t cols = 1 + ((size_t)m_Width * (size_t)m_Levels) / (size_t)m_CellSize;
+    // Same order of operations as the generic loop so both give identical results
+    OctaveTable<T> table;
+    T amplifier = 1;
+    for (int level = 0; level < std::min(m_Levels, MaxSpecialisedLevels); level++)
+    {
+        table.Amplitude[level] = amplifier;
+        table.Amplified += amplifier;
+        amplifier *= (T)m_Attenuation;
+    }
+    return table;
+}
+
+template<typename T>
+PerlinNoiseGenerator::OctaveKernel<T> PerlinNoiseGenerator::GetOctaveKernel() const
+{
+    switch (m_Levels)
+    {
+    case 1: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<1, T>;
+    case 2: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<2, T>;
+    case 3: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<3, T>;
+    case 4: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<4, T>;
+    case 5: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<5, T>;
+    case 6: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<6, T>;
+    case 7: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<7, T>;
+    case 8: return &PerlinNoiseGenerator::OctaveNoise2DRowKernel<8, T>;
+    default: return nullptr;
+    }
+}
+
+template<int Levels, typename T>
+void PerlinNoiseGenerator::OctaveNoise2DRowKernel(const int &x, const int &y, T *out, const size_t &count, const OctaveTable<T> &table) const
+{
+    static_assert(Levels >= 1 && Levels <= MaxSpecialisedLevels, "No octave table entries for this many levels");
+
+    // An AVX2 register holds 4 doubles or 8 floats
+    constexpr size_t lanes = 32 / sizeof(T);
+
+    size_t batched = 0;
+    if (Utils::HasAVX2)
+    {
+        batched = count & ~(lanes - 1);
+        Utils::OctaveNoise2DRowAVX2<Levels>(m_SeedHash, x, y, (double)m_CellSize, table.Amplitude, table.Amplified, out, batched);
+    }
 
-    for (size_t j = 0; j < rows; j++)
+    // Scalar fallback for the remainder of the row
+    for (size_t i = batched; i < count; i++)
     {
-        double y = p0.y + (j + 1) * m_CellSize;
-        for (size_t i = 0; i < cols; i++)
+        double X = (double)(x + (int)i) / (double)m_CellSize;
+        double Y = (double)y / (double)m_CellSize;
+
+        T sum = 0;
+        for (int level = 0; level < Levels; level++)
         {
-            double x = p0.x + (i + 1) * m_CellSize;
-            double dx = m_InfluenceVectors[i + j*m_Width].x;
-            double dy = m_InfluenceVectors[i + j*m_Width].y;
-            drawlist->AddLine(ImVec2(x, y), ImVec2(x + (m_CellSize / 2)*dx, y + (m_CellSize / 2)*dy), IM_COL32(200, 0, 0, 150));
+            sum += (T)Noise2D(X, Y) * table.Amplitude[level];
+            X *= 2.0;
+            Y *= 2.0;
         }
+        out[i] = sum / table.Amplified;
     }
 }
 
@@ -286,46 +1077,243 @@ void PerlinNoiseGenerator::UpdatePixelData()
     size_t hght = (size_t)m_Height;
     m_PixelData.resize(wdth * hght);
 
-    for (size_t j = 0; j < hght; j++)
+    // Split the map into tiles and spread them over the thread pool, every pixel only depends on
+    // its own coordinates so the result is the same for any thread count
+    size_t tilesX = (wdth + TileSize - 1) / TileSize;
+    size_t tilesY = (hght + TileSize - 1) / TileSize;
+    m_TilesDone = 0;
+    m_TileCount = tilesX * tilesY;
+
+    ThreadPool::Get().ParallelFor(tilesX * tilesY, [&](size_t tile)
+        {
+            size_t x0 = (tile % tilesX) * TileSize;
+            size_t y0 = (tile / tilesX) * TileSize;
+            size_t tileWidth = std::min((size_t)TileSize, wdth - x0);
+            size_t tileHeight = std::min((size_t)TileSize, hght - y0);
+
+            SampleRegion((int)x0, (int)y0, tileWidth, tileHeight, &m_PixelData[x0 + y0 * wdth], wdth);
+
+            m_TilesDone++;
+        });
+}
+
+void PerlinNoiseGenerator::UpdateFrameData(const double &time, const double &loopPeriod)
+{
+    size_t wdth = (size_t)m_Width;
+    size_t hght = (size_t)m_Height;
+    m_FrameData.resize(wdth * hght);
+
+    // Same tiles as UpdatePixelData, without the progress that would make the GUI hide the map every frame
+    size_t tilesX = (wdth + TileSize - 1) / TileSize;
+    size_t tilesY = (hght + TileSize - 1) / TileSize;
+
+    ThreadPool::Get().ParallelFor(tilesX * tilesY, [&](size_t tile)
+        {
+            size_t x0 = (tile % tilesX) * TileSize;
+            size_t y0 = (tile / tilesX) * TileSize;
+            size_t tileWidth = std::min((size_t)TileSize, wdth - x0);
+            size_t tileHeight = std::min((size_t)TileSize, hght - y0);
+
+            SampleFrame((int)x0, (int)y0, tileWidth, tileHeight, time, loopPeriod, &m_FrameData[x0 + y0 * wdth], wdth);
+        });
+}
+
+void PerlinNoiseGenerator::SampleFrame(const int &x, const int &y, const size_t &width, const size_t &height, const double &time,
+    const double &loopPeriod, double *out, const size_t &stride) const
+{
+    // A looping animation moves around a circle whose circumference is the distance covered in one period
+    bool loop = loopPeriod > 0.0;
+    double radius = loopPeriod / (2.0 * 3.14159265358979324);
+    double angle = loop ? time / radius : 0.0;
+    double Z = loop ? radius * cos(angle) : time;
+    double W = loop ? radius * sin(angle) : 0.0;
+
+    // Rows are sampled a level at a time like OctaveNoise2DRowGeneric, with the same order of operations as a
+    // per sample loop so the batched and scalar paths match
+    std::vector<double> X(width);
+    std::vector<double> noise(width);
+
+    for (size_t j = 0; j < height; j++)
     {
-        for (size_t i = 0; i < wdth; i++)
+        double *row = out + j * stride;
+        for (size_t i = 0; i < width; i++)
+        {
+            X[i] = (double)(x + (int)i) / (double)m_CellSize;
+            row[i] = 0.0;
+        }
+        double Y = (double)(y + (int)j) / (double)m_CellSize;
+        double z = Z;
+        double w = W;
+
+        double amplifier = 1.0;
+        double amplified = 0.0;
+
+        for (int level = 0; level < m_Levels; level++)
         {
-            m_PixelData[i + j * wdth] = (OctaveNoise2D(i, j) + 1.0f) / 2.0f;
+            if (loop)
+                Noise4DRow(X.data(), Y, z, w, noise.data(), width);
+            else
+                Noise3DRow(X.data(), Y, z, noise.data(), width);
+
+            for (size_t i = 0; i < width; i++)
+            {
+                row[i] += noise[i] * amplifier;
+                X[i] *= 2.0;
+            }
+            Y *= 2.0;
+            z *= 2.0;
+            w *= 2.0;
+
+            amplified += amplifier;
+            amplifier *= m_Attenuation;
         }
+
+        // Move the noise from [-1, 1] to [0, 1], the corners of a 3D or 4D cell can reach past it
+        for (size_t i = 0; i < width; i++)
+            row[i] = std::clamp((row[i] / amplified + 1.0) / 2.0, 0.0, 1.0);
     }
 }
 
-void PerlinNoiseGenerator::DrawNoiseHeightMap(ImDrawList *drawlist, const ImVec2 &p0)
+template<typename T>
+void PerlinNoiseGenerator::SampleRegion(const int &x, const int &y, const size_t &width, const size_t &height, T *out, const size_t &stride) const
 {
-    // Draw the noise map from the pixel data
-    for (size_t j = 0; j < m_Height; j++)
+    // Quantised heights are sampled in float one row at a time and then packed
+    using Sample = std::conditional_t<std::is_same_v<T, uint16_t>, float, T>;
+    std::vector<Sample> samples(std::is_same_v<T, Sample> ? 0 : width);
+
+    // The octave kernel and its amplitudes are picked once for the whole region
+    OctaveKernel<Sample> kernel = GetOctaveKernel<Sample>();
+    OctaveTable<Sample> table = GetOctaveTable<Sample>();
+
+    for (size_t j = 0; j < height; j++)
     {
-        for (size_t i = 0; i < m_Width; i++)
+        Sample *row = samples.data();
+        if constexpr (std::is_same_v<T, Sample>)
+            row = out + j * stride;
+
+        if (kernel)
+            (this->*kernel)(x, y + (int)j, row, width, table);
+        else
+            OctaveNoise2DRowGeneric(x, y + (int)j, row, width);
+
+        // Move the noise from [-1, 1] to [0, 1]
+        for (size_t i = 0; i < width; i++)
         {
-            double pixel = m_PixelData[i + j * m_Width];
-            uint32_t color = IM_COL32(255.0 * pixel, 255.0 * pixel, 255.0 * pixel, 255.0);
+            row[i] = (row[i] + 1.0f) / 2.0f;
+        }
 
-            if (!m_NoiseSettings.Color)
-            {
-                drawlist->AddRectFilled(ImVec2(p0.x + i, p0.y + j), ImVec2(p0.x + (i + 1), p0.y + (j + 1)), color);
-                continue;
-            }
-                
-            color = IM_COL32(136, 196, 128, 255);
-            pixel = double((int)(pixel * (double)m_NoiseSettings.Height)) / (double)(m_NoiseSettings.Height);
-
-            // Color based on noise value
-            if (pixel < m_NoiseSettings.Water)
-                color = IM_COL32(32, 64, 196, 255);
-            else if (pixel < m_NoiseSettings.Sand)
-                color = IM_COL32(180, 180, 75, 255);
-            else if (pixel > m_NoiseSettings.Snow)
-                color = IM_COL32(255, 255, 255, 255);
-            else if (pixel > m_NoiseSettings.Stone)
-                color = IM_COL32(51, 51, 51, 255);
-
-            drawlist->AddRectFilled(ImVec2(p0.x + i, p0.y + j), ImVec2(p0.x + (i + 1), p0.y + (j + 1)), color);
+        if constexpr (!std::is_same_v<T, Sample>)
+        {
+            for (size_t i = 0; i < width; i++)
+                out[i + j * stride] = QuantizeHeight(row[i]);
         }
     }
 }
 
+template void PerlinNoiseGenerator::SampleRegion<double>(const int &, const int &, const size_t &, const size_t &, double *, const size_t &) const;
+template void PerlinNoiseGenerator::SampleRegion<float>(const int &, const int &, const size_t &, const size_t &, float *, const size_t &) const;
+template void PerlinNoiseGenerator::SampleRegion<uint16_t>(const int &, const int &, const size_t &, const size_t &, uint16_t *, const size_t &) const;
+
+uint16_t PerlinNoiseGenerator::QuantizeHeight(const double &height)
+{
+    return (uint16_t)std::lround(std::clamp(height, 0.0, 1.0) * 65535.0);
+}
+
+void PerlinNoiseGenerator::BuildPreviewPalette(const NoiseSettings &settings, ShadingPalette &palette)
+{
+    if (settings.Color)
+        settings.BuildPalette(palette, Utils::PreviewColors);
+    else
+        palette.BuildGrayscale();
+}
+
+void PerlinNoiseGenerator::ConvertToRGBA(const double *heights, const size_t &count, const ShadingPalette &palette, uint32_t *out)
+{
+    const uint32_t *colors = palette.GetData();
+    double maxLevel = (double)palette.GetMaxLevel();
+
+    size_t i = 0;
+#ifdef PN_PREVIEW_SIMD
+    __m128d scale = _mm_set1_pd(maxLevel);
+    for (; i + 4 <= count; i += 4)
+    {
+        alignas(16) int32_t levels[4];
+        _mm_store_si128((__m128i*)levels, Utils::HeightsToLevels4(heights + i, scale));
+
+        out[i + 0] = colors[levels[0]];
+        out[i + 1] = colors[levels[1]];
+        out[i + 2] = colors[levels[2]];
+        out[i + 3] = colors[levels[3]];
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = colors[(int)std::clamp(heights[i] * maxLevel, 0.0, maxLevel)];
+}
+
+#ifndef PN_HEADLESS
+void PerlinNoiseGenerator::UpdateInfluenceImage(const uint32_t &width, const uint32_t &height, const float &scale)
+{
+    if (m_InfluenceImage && m_InfluenceVersion == m_ParametersVersion &&
+        m_InfluenceImage->GetWidth() == width && m_InfluenceImage->GetHeight() == height)
+        return;
+    m_InfluenceVersion = m_ParametersVersion;
+
+    int w = (int)width;
+    int h = (int)height;
+    float cellsize = (float)m_CellSize * scale;
+    m_InfluencePixels.assign((size_t)width * height, IM_COL32(50, 50, 50, 255));
+
+    // Scaled down cells narrower than a pixel only draw every step-th line and vector
+    size_t step = (size_t)std::max(1.0f, std::ceil(1.0f / cellsize));
+    float length = (float)(m_CellSize / 2) * scale * (float)step;
+
+    // Grid lines between the cells, leaving a border of one cell
+    uint32_t linecolor = IM_COL32(200, 200, 200, 40);
+    for (size_t x = step; (float)x * cellsize < (float)w; x += step)
+        Utils::DrawLine(m_InfluencePixels, w, h, glm::vec2((float)x * cellsize, cellsize), glm::vec2((float)x * cellsize, (float)h - cellsize), linecolor);
+    for (size_t y = step; (float)y * cellsize < (float)h; y += step)
+        Utils::DrawLine(m_InfluencePixels, w, h, glm::vec2(cellsize, (float)y * cellsize), glm::vec2((float)w - cellsize, (float)y * cellsize), linecolor);
+
+    // Add 1 to rows/cols because we need n + 1 influence vectors for n cells (for 1 cell we need 4 influence vectors, 2 in x and 2 in y)
+    size_t rows = 1 + ((size_t)m_Height * (size_t)m_Levels) / (size_t)m_CellSize;
+    size_t cols = 1 + ((size_t)m_Width * (size_t)m_Levels) / (size_t)m_CellSize;
+    for (size_t j = 0; j < rows; j += step)
+    {
+        for (size_t i = 0; i < cols; i += step)
+        {
+            glm::vec2 origin((i + 1) * cellsize, (j + 1) * cellsize);
+            glm::vec2 influence = GetInfluenceVector((int)i, (int)j);
+            Utils::DrawLine(m_InfluencePixels, w, h, origin, origin + influence * length, IM_COL32(200, 0, 0, 150));
+        }
+    }
+
+    // Outline
+    uint32_t border = IM_COL32(255, 255, 255, 255);
+    Utils::DrawLine(m_InfluencePixels, w, h, glm::vec2(0.0f), glm::vec2((float)w - 1.0f, 0.0f), border);
+    Utils::DrawLine(m_InfluencePixels, w, h, glm::vec2(0.0f, (float)h - 1.0f), glm::vec2((float)w - 1.0f, (float)h - 1.0f), border);
+    Utils::DrawLine(m_InfluencePixels, w, h, glm::vec2(0.0f), glm::vec2(0.0f, (float)h - 1.0f), border);
+    Utils::DrawLine(m_InfluencePixels, w, h, glm::vec2((float)w - 1.0f, 0.0f), glm::vec2((float)w - 1.0f, (float)h - 1.0f), border);
+
+    Utils::UploadImage(m_InfluenceImage, width, height, m_InfluencePixels);
+}
+
+void PerlinNoiseGenerator::UpdateHeightMapImage()
+{
+    // Animation frames change the pixel data through the version, shading changes through the settings
+    uint32_t width = (uint32_t)m_Width;
+    uint32_t height = (uint32_t)m_Height;
+    if (m_HeightMapImage && m_HeightMapVersion == m_Version && m_HeightMapSettings == m_NoiseSettings &&
+        m_HeightMapImage->GetWidth() == width && m_HeightMapImage->GetHeight() == height)
+        return;
+
+    // The palette is only rebuilt when the shading changes, not for every new frame of noise
+    if (m_HeightMapPalette.IsEmpty() || m_HeightMapSettings != m_NoiseSettings)
+        BuildPreviewPalette(m_NoiseSettings, m_HeightMapPalette);
+    m_HeightMapVersion = m_Version;
+    m_HeightMapSettings = m_NoiseSettings;
+
+    m_HeightMapPixels.resize((size_t)width * height);
+    ConvertToRGBA(m_PixelData.data(), m_HeightMapPixels.size(), m_HeightMapPalette, m_HeightMapPixels.data());
+    Utils::UploadImage(m_HeightMapImage, width, height, m_HeightMapPixels);
+}
+#endif
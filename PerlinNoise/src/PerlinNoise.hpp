@@ -1,11 +1,19 @@
 #pragma once
 
+#ifndef PN_HEADLESS
 #include "imgui.h"
+#include "Walnut/Image.h"
+#endif
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
 #include <vector>
-#include <random>
+
+#include "ShadingPalette.hpp"
 
 
 struct NoiseSettings
@@ -16,6 +24,27 @@ struct NoiseSettings
     float Sand   = 0.425f;
     float Stone  = 0.55f;
     float Snow   = 0.625f;
+
+    bool operator==(const NoiseSettings &other) const
+    {
+        return Color == other.Color && Height == other.Height && Water == other.Water &&
+            Sand == other.Sand && Stone == other.Stone && Snow == other.Snow;
+    }
+    bool operator!=(const NoiseSettings &other) const { return !(*this == other); }
+
+    // Paints the terrain classes into palette, one color per voxel level of a map Height levels tall.
+    // Water and sand take precedence over snow and stone, everything in between is grass.
+    void BuildPalette(ShadingPalette &palette, const ShadingPalette::TerrainColors &colors) const
+    {
+        float lowest = std::numeric_limits<float>::lowest();
+        float highest = std::numeric_limits<float>::max();
+
+        palette.Reset(std::max(Height, 1), colors.Grass);
+        palette.AddBand(Stone, highest, colors.Stone);
+        palette.AddBand(Snow, highest, colors.Snow);
+        palette.AddBand(lowest, Sand, colors.Sand);
+        palette.AddBand(lowest, Water, colors.Water);
+    }
 };
 
 class PerlinNoiseGenerator
@@ -25,16 +54,71 @@ public:
         const int &cellsize, const int &levels, const double &attenuation)
         : m_Seed(seed), m_Width(width), m_Height(height), m_CellSize(cellsize), m_Levels(levels), m_Attenuation(attenuation)
     {
-        m_InfluenceVectors.resize((size_t)width * (size_t)height);
         m_PixelData.resize((size_t)width * (size_t)height);
-        srand(seed);
+        m_SeedHash = HashSeed(seed);
     }
 
+    // The thread pool outlives the generator, so the tasks it queued are waited for
+    ~PerlinNoiseGenerator() { Wait(); }
+
 public:
+#ifndef PN_HEADLESS
     bool GUI(size_t &width, size_t &height);
-    const std::vector<double>& const GetNoise() { return m_PixelData; }
+#endif
+    void Generate(const int &seed, const int &width, const int &height,
+        const int &cellsize, const int &levels, const double &attenuation);
+
+    // Generates the noise on the shared thread pool, GetNoise() must not be used until IsGenerating() is false
+    void GenerateAsync(const int &seed, const int &width, const int &height,
+        const int &cellsize, const int &levels, const double &attenuation);
+    bool IsGenerating() const { return m_Generating; }
+
+    // Takes over a map made from these parameters somewhere else, such as one loaded from a scene file, so the
+    // previews show it and the parameters describe it. Waits for the noise and frames being generated first,
+    // they write the same pixel data.
+    void UseNoise(const int &seed, const int &width, const int &height, const int &cellsize, const int &levels,
+        const double &attenuation, const std::vector<double> &noise);
+
+    // Changes every time the pixel data is regenerated, 0 until it has been generated once
+    uint64_t GetVersion() const { return m_Version; }
+    float GetProgress() const { return m_TileCount ? (float)m_TilesDone / (float)m_TileCount : 0.0f; }
+
+    // Animation frames sample Noise3D with time as the third axis, so the map changes smoothly between frames.
+    // With a loop period above 0 they sample Noise4D with time going around a circle in the last two axes
+    // instead, so the animation repeats every period. Frames replace the pixel data until Generate is called.
+    void GenerateFrame(const double &time);
+
+    // Generates the frame into a back buffer on the thread pool while GetNoise() keeps returning the current
+    // one, returns false if a frame or the noise is still being generated
+    bool GenerateFrameAsync(const double &time);
+
+    // Swaps the last finished frame in, returns true if GetNoise() changed. Nothing is swapped while the noise
+    // is being generated, since that writes the same pixel data.
+    bool SwapFrame();
+    bool IsGeneratingFrame() const { return m_FrameGenerating; }
+
+    // Waits for the frame being generated and drops it, along with a finished one that was not swapped in
+    void DiscardFrames();
+
+    // Waits until neither the noise nor a frame is being generated on the thread pool
+    void Wait() const;
+
+    // Discards the frames. If a frame was swapped in, the map is generated again unless it already is being generated.
+    void StopAnimation();
+
+    double GetAnimationLoop() const { return m_AnimationLoop; }
+    void SetAnimationLoop(const double &period) { m_AnimationLoop = std::max(period, 0.0); }
+
+    const std::vector<double>& GetNoise() const { return m_PixelData; }
     NoiseSettings* GetNoiseSettings() { return &m_NoiseSettings; }
-    
+    const NoiseSettings* GetNoiseSettings() const { return &m_NoiseSettings; }
+    const int GetWidth() const { return m_Width; }
+    const int GetHeight() const { return m_Height; }
+    const int GetSeed() const { return m_Seed; }
+    const int GetCellSize() const { return m_CellSize; }
+    const int GetLevels() const { return m_Levels; }
+    const double GetAttenuation() const { return m_Attenuation; }
+
 
 public:
     void SetHeight(const int   &height) { m_NoiseSettings.Height = height; }
@@ -46,9 +130,57 @@ public:
 public:
     const int GetNoiseHeight() const { return m_NoiseSettings.Height; }
 
-private:
-    double Noise2D(double x, double y);
-    double OctaveNoise2D(const int &x, const int &y);
+public:
+    // Influence vector of a lattice point, hashed from the seed and lattice coordinates so no table is stored
+    glm::vec2 GetInfluenceVector(const int &x, const int &y) const;
+
+    // Samples the noise using the current seed. The 3D and 4D versions hash one more lattice coordinate per
+    // axis the same way and are scaled so their gradients have unit length like Noise2D's.
+    double Noise2D(double x, double y) const;
+    double Noise3D(double x, double y, double z) const;
+    double Noise4D(double x, double y, double z, double w) const;
+    double OctaveNoise2D(const int &x, const int &y) const;
+
+    // Batched versions that sample count consecutive points along a row, using AVX2 when the CPU supports it.
+    // The batched path evaluates the gradient dot products in double precision while Noise2D rounds them to
+    // float, so results match the scalar path to within 1e-6.
+    // T is the precision the samples are blended in, double or float. Float fits 8 samples in an AVX2 register
+    // instead of 4 and matches double to within 1e-6. The coordinates stay double for both, so points far from
+    // the origin keep the fraction inside their lattice cell.
+    template<typename T>
+    void Noise2DRow(const double *x, const double &y, T *out, const size_t &count) const;
+    template<typename T>
+    void OctaveNoise2DRow(const int &x, const int &y, T *out, const size_t &count) const;
+
+    // OctaveNoise2DRow with the levels looped over at run time, used for level counts without a specialised
+    // kernel and as the reference the kernels are benchmarked against
+    template<typename T>
+    void OctaveNoise2DRowGeneric(const int &x, const int &y, T *out, const size_t &count) const;
+
+    // Fills a width x height block of heights in the range [0, 1] starting at noise coordinates (x, y).
+    // Only reads the generator's parameters, so it is safe to call from several threads at once.
+    // T is double, float, or uint16_t for heights sampled in float and stored with QuantizeHeight.
+    template<typename T>
+    void SampleRegion(const int &x, const int &y, const size_t &width, const size_t &height, T *out, const size_t &stride) const;
+
+    // Noise3D and Noise4D of count points along a row, batched with AVX2 like Noise2DRow. These blend in double
+    // the same way the scalar versions do, so results match them exactly.
+    void Noise3DRow(const double *x, const double &y, const double &z, double *out, const size_t &count) const;
+    void Noise4DRow(const double *x, const double &y, const double &z, const double &w, double *out, const size_t &count) const;
+
+    // Fills a block of heights like SampleRegion, from the animation frame at time looping every loopPeriod (0 for no loop)
+    void SampleFrame(const int &x, const int &y, const size_t &width, const size_t &height, const double &time,
+        const double &loopPeriod, double *out, const size_t &stride) const;
+
+    // 16-bit heights split [0, 1] into 65535 steps, a quarter of the memory of double heights
+    static uint16_t QuantizeHeight(const double &height);
+    static double DequantizeHeight(const uint16_t &height) { return (double)height / 65535.0; }
+
+    // Palette the height map preview is drawn with: grayscale, or the terrain of the voxel levels like the renderer shades them
+    static void BuildPreviewPalette(const NoiseSettings &settings, ShadingPalette &palette);
+
+    // Colors heights in [0, 1] as 0xAABBGGRR by scaling them to the palette's levels and looking each one up
+    static void ConvertToRGBA(const double *heights, const size_t &count, const ShadingPalette &palette, uint32_t *out);
 
 private:
     int m_Seed = 0;
@@ -57,13 +189,82 @@ private:
     int m_CellSize = 16;
     int m_Levels = 1;
     double m_Attenuation = 1.0f;
-    std::vector<glm::vec2> m_InfluenceVectors;
+    uint32_t m_SeedHash = 0;
     std::vector<double> m_PixelData;
     NoiseSettings m_NoiseSettings;
 
+    // Pixel data is generated in square tiles so each task works on a cache sized block
+    static constexpr int TileSize = 64;
+    std::atomic<size_t> m_TilesDone{ 0 };
+    std::atomic<size_t> m_TileCount{ 0 };
+    std::atomic<bool> m_Generating{ false };
+    std::atomic<bool> m_Generated{ false };
+    std::atomic<uint64_t> m_Version{ 0 };
+
+    // Frames are generated into m_FrameData and swapped with m_PixelData on the thread that reads it
+    std::vector<double> m_FrameData;
+    std::atomic<bool> m_FrameGenerating{ false };
+    std::atomic<bool> m_FrameReady{ false };
+    std::atomic<bool> m_Animated{ false };
+
+    // Only read when a frame is started, the frame's task gets its own copy
+    double m_AnimationLoop = 0.0;
+
+    // Changes whenever SetParameters does, the influence vectors only depend on the parameters
+    uint64_t m_ParametersVersion = 0;
+
+#ifndef PN_HEADLESS
+    // The previews are drawn into textures that are only redrawn and uploaded when what they show changes
+    std::shared_ptr<Walnut::Image> m_HeightMapImage;
+    std::vector<uint32_t> m_HeightMapPixels;
+    uint64_t m_HeightMapVersion = 0;
+    NoiseSettings m_HeightMapSettings;
+    ShadingPalette m_HeightMapPalette;
+
+    // Grids larger than this on a side are drawn scaled down, a 512 wide map at 8 levels would be a 64 MB texture
+    static constexpr uint32_t MaxInfluenceImageSize = 1024;
+    std::shared_ptr<Walnut::Image> m_InfluenceImage;
+    std::vector<uint32_t> m_InfluencePixels;
+    uint64_t m_InfluenceVersion = 0;
+#endif
+
+private:
+    // Octave kernels take the level count as a template parameter, so their level loop has a fixed trip count,
+    // and read the amplitudes from a table built once per call instead of once per pixel
+    static constexpr int MaxSpecialisedLevels = 8;
+
+    template<typename T>
+    struct OctaveTable
+    {
+        T Amplitude[MaxSpecialisedLevels] = {};
+        T Amplified = 0;
+    };
+
+    template<typename T>
+    using OctaveKernel = void (PerlinNoiseGenerator::*)(const int &, const int &, T *, const size_t &, const OctaveTable<T> &) const;
+
+    template<typename T>
+    OctaveTable<T> GetOctaveTable() const;
+    // Returns nullptr if there is no kernel for m_Levels
+    template<typename T>
+    OctaveKernel<T> GetOctaveKernel() const;
+    template<int Levels, typename T>
+    void OctaveNoise2DRowKernel(const int &x, const int &y, T *out, const size_t &count, const OctaveTable<T> &table) const;
+
 private:
-    void UpdateInfluenceVectors();
-    void DrawInfluenceVectors(ImDrawList *drawlist, const ImVec2 &p0);
+    void SetParameters(const int &seed, const int &width, const int &height,
+        const int &cellsize, const int &levels, const double &attenuation);
+    // True if the pixel data was already generated from these parameters
+    bool IsCurrent(const int &seed, const int &width, const int &height,
+        const int &cellsize, const int &levels, const double &attenuation) const;
+    static uint32_t HashSeed(const int &seed);
+    void UpdateNoise();
     void UpdatePixelData();
-    void DrawNoiseHeightMap(ImDrawList *drawlist, const ImVec2 &p0);
+    void UpdateFrameData(const double &time, const double &loopPeriod);
+#ifndef PN_HEADLESS
+    // Redraw the preview textures if they are out of date, width and height are the size of the influence grid's
+    // texture and scale is its size relative to the grid
+    void UpdateInfluenceImage(const uint32_t &width, const uint32_t &height, const float &scale);
+    void UpdateHeightMapImage();
+#endif
 };
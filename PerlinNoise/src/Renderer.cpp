@@ -1,11 +1,17 @@
 #include "Renderer.hpp"
-#include "Walnut/Random.h"
+#include "ThreadPool.hpp"
+#include "AllocationCounter.hpp"
 
-#include <numeric>
 #include <algorithm>
-#include <execution>
+#include <chrono>
 #include <iostream>
 
+// Primary rays are traced in packets of four with SSE, which every x64 CPU has
+#if !defined(PN_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define PN_RAY_PACKETS
+#endif
+
 namespace Utils {
 	static uint32_t ConvertToRGBA(const glm::vec4 &color)
 	{
@@ -18,6 +24,16 @@ namespace Utils {
 		return (uint32_t)((a << 24) | (b << 16) | (g << 8) | r);
 	}
 
+	// Shading colors, packed once so the palette is built from exactly the bytes the float colors converted to
+	static const ShadingPalette::TerrainColors TerrainColors = {
+		ConvertToRGBA(glm::vec4(0.1f, 0.25f, 1.0f, 1.0f)),
+		ConvertToRGBA(glm::vec4(0.7f, 0.7f, 0.3f, 1.0f)),
+		ConvertToRGBA(glm::vec4(0.55f, 0.8f, 0.5f, 1.0f)),
+		ConvertToRGBA(glm::vec4(0.2f, 0.2f, 0.2f, 1.0f)),
+		ConvertToRGBA(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)),
+	};
+	static const uint32_t SkyColor = ConvertToRGBA(glm::vec4(0.5f, 0.65f, 1.0f, 1.0f));
+
 	// Fast Ray-AABB intersection algorithm (using the slab method)
 	// Code adapted from https://gist.github.com/DomNomNom/46bb1ce47f68d255fd5d
 	static float RayAABBIntersection(const Ray &ray, const glm::vec3 &boxMin, const glm::vec3 &boxMax)
@@ -40,33 +56,326 @@ namespace Utils {
 		return tNear;
 	};
 
-	// Scans the chunk to see if we intersect it, if we do we perform this check for its children
-	static void ScanChunks(const Ray &ray, OcTree *chunk, float &hitTime, glm::vec3 &hitPoint)
+	// Slab test that returns the ray's entry and exit times for the box, the ray misses if tNear > tFar
+	static void RayAABBInterval(const Ray &ray, const glm::vec3 &inverseDirection, const glm::vec3 &boxMin, const glm::vec3 &boxMax, float &tNear, float &tFar)
 	{
-		// If the chunk does not contain a point we do not want to intersect it
-		if (chunk->GetPointCount() == 0)
-			return;
+		glm::vec3 tMin = (boxMin - ray.Origin) * inverseDirection;
+		glm::vec3 tMax = (boxMax - ray.Origin) * inverseDirection;
+		glm::vec3 t1 = min(tMin, tMax);
+		glm::vec3 t2 = max(tMin, tMax);
+		tNear = std::max(std::max(t1.x, t1.y), t1.z);
+		tFar = std::min(std::min(t2.x, t2.y), t2.z);
+	}
 
-		// Intersect against the current oct
-		const AABB &oct = chunk->GetOct();
-		std::vector<glm::vec3> boundaries = oct.GetBoundaries();
-		float t = RayAABBIntersection(ray, boundaries[0], boundaries[1]);
+	// A node of the OcTree along with the bounds derived while walking down to it
+	struct OcTreeChunk
+	{
+		uint32_t Node;
+		glm::vec3 Min;
+		float Size;
+	};
 
-		// Return if we did not have an intsection
-		if (t < 0.0f)
-			return;
+	// Coarsest block size progressive rendering traces at while the camera moves
+	constexpr uint32_t MaxMotionScale = 4;
+
+	// Every level pushes at most 8 children, a 2^31 sized tree is more than the renderer will ever build
+	constexpr int MaxOcTreeDepth = 31;
+
+	// Walks the subtree below start front to back and stops at the first leaf the ray hits. Children are visited in the order
+	// the ray enters them and the children of a node do not overlap, so the first leaf hit is the closest one.
+	// Bounds are computed from the parent's minimum corner and size while walking down. Boxes the ray enters after
+	// hitTime are skipped, so a hit that is already known cuts the walk short. Returns false if nothing closer was hit.
+	static bool ScanSubtree(const Ray &ray, const glm::vec3 &inverseDirection, const OcTree &tree, const OcTreeChunk &start, float &hitTime, uint32_t &hitNode)
+	{
+		OcTreeChunk stack[8 * MaxOcTreeDepth + 1];
+		int top = 0;
 
-		// Update the time if the box is size 1x1x1
-		if (chunk->GetSize() == 1 && t < hitTime)
+		float tNear, tFar;
+		stack[top++] = start;
+		while (top > 0)
 		{
-			hitTime = t;
-			hitPoint = chunk->GetPoints()[0];
+			OcTreeChunk chunk = stack[--top];
+			const OcTree::Node &node = tree.GetNode(chunk.Node);
+
+			// Leaves are only hit from the outside, the camera can be inside the box of a leaf
+			if (node.ChildMask == 0)
+			{
+				RayAABBInterval(ray, inverseDirection, chunk.Min, chunk.Min + chunk.Size, tNear, tFar);
+				if (tNear < 0.0f || tNear > hitTime)
+					continue;
+
+				hitTime = tNear;
+				hitNode = chunk.Node;
+				return true;
+			}
+
+			// Intersect the children and sort the ones we hit by their entry time
+			float half = chunk.Size * 0.5f;
+			OcTreeChunk children[8];
+			float entries[8];
+			int count = 0;
+
+			uint32_t child = node.Index;
+			for (int i = 0; i < 8; i++)
+			{
+				if (!(node.ChildMask & (1 << i)))
+					continue;
+
+				glm::vec3 min = chunk.Min + OcTree::ChildOffset(i) * half;
+				uint32_t index = child++;
+
+				RayAABBInterval(ray, inverseDirection, min, min + half, tNear, tFar);
+				if (tNear > tFar || tFar < 0.0f || tNear > hitTime)
+					continue;
+
+				// Insertion sort, there are at most 8 children
+				int j = count++;
+				for (; j > 0 && entries[j - 1] > tNear; j--)
+				{
+					entries[j] = entries[j - 1];
+					children[j] = children[j - 1];
+				}
+				entries[j] = tNear;
+				children[j] = { index, min, half };
+			}
+
+			// Push the farthest child first so the closest one is visited next
+			for (int i = count - 1; i >= 0; i--)
+				stack[top++] = children[i];
 		}
-			
 
-		// If we hit the chunk, check the children of the chunk
-		for (const auto &child : chunk->GetChildren())
-			ScanChunks(ray, child, hitTime, hitPoint);
+		return false;
+	}
+
+	// Scans the whole OcTree for the closest leaf the ray hits before hitTime
+	static bool ScanChunks(const Ray &ray, const OcTree &tree, float &hitTime, uint32_t &hitNode)
+	{
+		glm::vec3 inverseDirection = glm::vec3(1.0f) / ray.Direction;
+
+		float tNear, tFar;
+		RayAABBInterval(ray, inverseDirection, glm::vec3(0.0f), glm::vec3((float)tree.GetSize()), tNear, tFar);
+		if (tNear > tFar || tFar < 0.0f)
+			return false;
+
+		return ScanSubtree(ray, inverseDirection, tree, { 0, glm::vec3(0.0f), (float)tree.GetSize() }, hitTime, hitNode);
+	}
+
+#ifdef PN_RAY_PACKETS
+	// Four rays stored lane by lane so one SSE instruction works on all of them
+	struct RayPacket
+	{
+		__m128 OriginX, OriginY, OriginZ;
+		__m128 InverseX, InverseY, InverseZ;
+	};
+
+	// Slab test of every ray in the packet against one box, returns the lanes that hit it
+	static inline __m128 PacketAABBInterval(const RayPacket &packet, const glm::vec3 &boxMin, const glm::vec3 &boxMax, __m128 &tNear)
+	{
+		__m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin.x), packet.OriginX), packet.InverseX);
+		__m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax.x), packet.OriginX), packet.InverseX);
+		__m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin.y), packet.OriginY), packet.InverseY);
+		__m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax.y), packet.OriginY), packet.InverseY);
+		__m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin.z), packet.OriginZ), packet.InverseZ);
+		__m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax.z), packet.OriginZ), packet.InverseZ);
+
+		tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_min_ps(z0, z1));
+		__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_max_ps(z0, z1));
+
+		return _mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmpge_ps(tFar, _mm_setzero_ps()));
+	}
+
+	// Walks the OcTree with all rays of the packet at once, sharing one stack. Every entry on the stack carries the lanes still
+	// interested in it, a lane drops out of a subtree it misses or that starts behind its closest hit so far. Once a single lane
+	// is left the subtree is handed to the scalar traversal, which can stop at its first hit.
+	static void ScanChunksPacket(const Ray rays[4], const int &lanes, const OcTree &tree, float hitTimes[4], uint32_t hitNodes[4])
+	{
+		struct PacketChunk
+		{
+			OcTreeChunk Chunk;
+			int Lanes;
+		};
+
+		glm::vec3 inverseDirections[4];
+		float values[6][4];
+		for (int i = 0; i < 4; i++)
+		{
+			inverseDirections[i] = glm::vec3(1.0f) / rays[i].Direction;
+			values[0][i] = rays[i].Origin.x;
+			values[1][i] = rays[i].Origin.y;
+			values[2][i] = rays[i].Origin.z;
+			values[3][i] = inverseDirections[i].x;
+			values[4][i] = inverseDirections[i].y;
+			values[5][i] = inverseDirections[i].z;
+		}
+
+		RayPacket packet;
+		packet.OriginX = _mm_loadu_ps(values[0]);
+		packet.OriginY = _mm_loadu_ps(values[1]);
+		packet.OriginZ = _mm_loadu_ps(values[2]);
+		packet.InverseX = _mm_loadu_ps(values[3]);
+		packet.InverseY = _mm_loadu_ps(values[4]);
+		packet.InverseZ = _mm_loadu_ps(values[5]);
+
+		// Visiting child (i ^ signs) for i = 0..7 is front to back for rays pointing along the signs. Lanes pointing
+		// another way still find their closest hit, they just prune less
+		int first = 0;
+		while (first < 3 && !(lanes & (1 << first)))
+			first++;
+		const glm::vec3 &direction = rays[first].Direction;
+		int signs = (direction.x < 0.0f ? 1 : 0) | (direction.y < 0.0f ? 2 : 0) | (direction.z < 0.0f ? 4 : 0);
+
+		PacketChunk stack[8 * MaxOcTreeDepth + 1];
+		int top = 0;
+		stack[top++] = { { 0, glm::vec3(0.0f), (float)tree.GetSize() }, lanes };
+
+		__m128 best = _mm_loadu_ps(hitTimes);
+		while (top > 0)
+		{
+			PacketChunk entry = stack[--top];
+			const OcTreeChunk &chunk = entry.Chunk;
+
+			__m128 tNear;
+			__m128 hit = PacketAABBInterval(packet, chunk.Min, chunk.Min + chunk.Size, tNear);
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(tNear, best));
+			int active = _mm_movemask_ps(hit) & entry.Lanes;
+			if (!active)
+				continue;
+
+			const OcTree::Node &node = tree.GetNode(chunk.Node);
+			if (node.ChildMask == 0)
+			{
+				// Leaves are only hit from the outside, the camera can be inside the box of a leaf
+				active &= _mm_movemask_ps(_mm_cmpge_ps(tNear, _mm_setzero_ps()));
+				if (!active)
+					continue;
+
+				float entries[4];
+				_mm_storeu_ps(entries, tNear);
+				for (int i = 0; i < 4; i++)
+				{
+					if (active & (1 << i))
+					{
+						hitTimes[i] = entries[i];
+						hitNodes[i] = chunk.Node;
+					}
+				}
+				best = _mm_loadu_ps(hitTimes);
+				continue;
+			}
+
+			// A single ray left, let it stop at its first hit
+			if ((active & (active - 1)) == 0)
+			{
+				int i = 0;
+				while (!(active & (1 << i)))
+					i++;
+
+				if (ScanSubtree(rays[i], inverseDirections[i], tree, chunk, hitTimes[i], hitNodes[i]))
+					best = _mm_loadu_ps(hitTimes);
+				continue;
+			}
+
+			// Push the last child first so they are visited in order
+			float half = chunk.Size * 0.5f;
+			for (int k = 7; k >= 0; k--)
+			{
+				int i = k ^ signs;
+				if (node.ChildMask & (1 << i))
+					stack[top++] = { { OcTree::ChildIndex(node, i), chunk.Min + OcTree::ChildOffset(i) * half, half }, active };
+			}
+		}
+	}
+#endif
+	// Marches the ray through the columns of the heightfield in the order it crosses them, so the first voxel hit
+	// is the closest one. Each step tests the biggest mip cell around the ray and skips it if the ray passes above
+	// or below every voxel in it, otherwise it moves down a level until it reaches a single column.
+	static void MarchHeightField(const Ray &ray, const HeightField &field, float &hitTime, glm::vec3 &hitPoint)
+	{
+		glm::vec3 inverseDirection = glm::vec3(1.0f) / ray.Direction;
+
+		// Clip the ray to the bounds of the map
+		const HeightField::Range &bounds = field.GetBounds();
+		if (bounds.Min > bounds.Max)
+			return;
+
+		float t, tFar;
+		glm::vec3 boxMin = glm::vec3(0.0f, (float)bounds.Min, 0.0f);
+		glm::vec3 boxMax = glm::vec3((float)field.GetWidth(0), (float)bounds.Max + 1.0f, (float)field.GetDepth(0));
+		RayAABBInterval(ray, inverseDirection, boxMin, boxMax, t, tFar);
+		if (t > tFar || tFar < 0.0f)
+			return;
+		t = std::max(t, 0.0f);
+
+		glm::ivec2 step = glm::ivec2(ray.Direction.x < 0.0f ? -1 : 1, ray.Direction.z < 0.0f ? -1 : 1);
+		int top = field.GetLevelCount() - 1;
+		int level = top;
+		glm::ivec2 cell = glm::ivec2(0);
+
+		while (true)
+		{
+			float size = (float)(1 << level);
+			glm::vec2 cellMin = glm::vec2(cell) * size;
+
+			// Time the ray leaves the cell on each axis
+			float tx = ray.Direction.x != 0.0f ? (cellMin.x + (step.x > 0 ? size : 0.0f) - ray.Origin.x) * inverseDirection.x : std::numeric_limits<float>::max();
+			float tz = ray.Direction.z != 0.0f ? (cellMin.y + (step.y > 0 ? size : 0.0f) - ray.Origin.z) * inverseDirection.z : std::numeric_limits<float>::max();
+			float tExit = std::max(std::min(std::min(tx, tz), tFar), t);
+
+			// Heights the ray covers while inside the cell, padded so rounding never skips a voxel
+			float y0 = ray.Origin.y + ray.Direction.y * t;
+			float y1 = ray.Origin.y + ray.Direction.y * tExit;
+			float yLow = std::min(y0, y1) - 1e-3f;
+			float yHigh = std::max(y0, y1) + 1e-3f;
+
+			const HeightField::Range &range = field.GetRange(level, cell.x, cell.y);
+			if (yHigh >= (float)range.Min && yLow <= (float)range.Max + 1.0f)
+			{
+				if (level > 0)
+				{
+					// Move down to the child the ray is in, clamped so rounding cannot leave the cell
+					level--;
+					glm::vec3 point = ray.Origin + ray.Direction * t;
+					float childSize = size * 0.5f;
+					glm::ivec2 child = glm::ivec2((int)std::floor(point.x / childSize), (int)std::floor(point.z / childSize));
+					child = glm::clamp(child, cell * 2, cell * 2 + 1);
+					cell = glm::min(child, glm::ivec2(field.GetWidth(level) - 1, field.GetDepth(level) - 1));
+					continue;
+				}
+
+				// Test the column's voxel, leaves containing the camera do not count as a hit
+				float tNear, tVoxelFar;
+				glm::vec3 voxel = glm::vec3((float)cell.x, (float)range.Min, (float)cell.y);
+				RayAABBInterval(ray, inverseDirection, voxel, voxel + 1.0f, tNear, tVoxelFar);
+				if (tNear <= tVoxelFar && tNear >= 0.0f)
+				{
+					hitTime = tNear;
+					hitPoint = voxel + 0.5f;
+					return;
+				}
+			}
+
+			// Step into the neighbouring cell on the axis the ray leaves through first
+			if (tExit >= tFar)
+				return;
+			t = tExit;
+
+			glm::ivec2 previous = cell;
+			if (tx < tz)
+				cell.x += step.x;
+			else
+				cell.y += step.y;
+
+			if (cell.x < 0 || cell.y < 0 || cell.x >= field.GetWidth(level) || cell.y >= field.GetDepth(level))
+				return;
+
+			// Move up while the step left the parent cell, the new parent can be skipped as a whole
+			while (level < top && (cell.x >> 1 != previous.x >> 1 || cell.y >> 1 != previous.y >> 1))
+			{
+				cell = glm::ivec2(cell.x >> 1, cell.y >> 1);
+				previous = glm::ivec2(previous.x >> 1, previous.y >> 1);
+				level++;
+			}
+		}
 	}
 }
 
@@ -74,6 +383,7 @@ namespace Utils {
 
 void Renderer::OnResize(uint32_t width, uint32_t height)
 {
+#ifndef PN_HEADLESS
 	m_Width = width;
 	m_Height = height;
 
@@ -89,139 +399,393 @@ void Renderer::OnResize(uint32_t width, uint32_t height)
 	{
 		m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA); 
 	}
+#else
+	// Without an image to compare against, only reallocate when the size changes
+	if (m_ColorBuffer && m_Width == width && m_Height == height)
+		return;
+
+	m_Width = width;
+	m_Height = height;
+#endif
 
 	delete[] m_ColorBuffer;
 	m_ColorBuffer = new uint32_t[width * height];
+
+	Invalidate();
+}
+
+bool Renderer::UpdateScene(Scene &scene)
+{
+	// The voxels only depend on the noise and the height scale, shading changes are picked up by Render
+	bool built = m_BuiltScene == &scene;
+	if (built && m_BuiltNoiseVersion == scene.GetNoiseVersion() && m_BuiltHeightVersion == scene.GetHeightVersion())
+		return false;
+
+	m_ActiveScene = &scene;
+	m_ActiveScene->Invalidate();
+
+	m_BuiltScene = &scene;
+	m_BuiltNoiseVersion = scene.GetNoiseVersion();
+	m_BuiltHeightVersion = scene.GetHeightVersion();
+
+	m_VoxelHeight = std::max(scene.GetNoiseSettings()->Height, 1);
+
+	// A loaded scene file or a streamed window brings the OcTree and HeightField built for its noise
+	if (scene.IsBuilt())
+		return true;
+
+	// Get the maximum dimension of the noise, the OcTree rounds it up to a power of two
+	uint32_t size = std::max((int)std::max(m_ActiveScene->NoiseWidth, m_ActiveScene->NoiseHeight), m_VoxelHeight);
+
+	// Set the points up for the scene
+	m_ActiveScene->GeneratePoints(m_Points, m_VoxelHeight);
+
+	// Generate the OcTree and HeightField for the scene
+	m_ActiveScene->ocTree->Generate(size, m_Points);
+	m_ActiveScene->heightField->Generate(m_ActiveScene->Noise, m_ActiveScene->NoiseWidth, m_ActiveScene->NoiseHeight, m_VoxelHeight);
+
+	// Neither points into a loaded scene file any more
+	m_ActiveScene->File.reset();
+	m_ActiveScene->SetBuilt();
+
+	if (!m_Settings.Verbose)
+		return true;
+
+	std::cout << "Noise and OcTree Generated" << '\n';
+	uint32_t dimension = m_ActiveScene->ocTree->GetSize();
+	std::cout << "Dimension: " << dimension << 'x' << dimension << 'x' << dimension << '\n';
+	std::cout << "Noise Data Count: " << m_ActiveScene->Noise.size() << '\n';
+	std::cout << "Scene Octs Count: " << m_ActiveScene->ocTree->GetOctCount() << '\n';
+	std::cout << "OcTree Memory: " << m_ActiveScene->ocTree->GetMemoryUsage() / 1024 << "KB" << '\n';
+	std::cout << "HeightField Memory: " << m_ActiveScene->heightField->GetMemoryUsage() / 1024 << "KB" << '\n';
+	std::cout << '\n';
+	return true;
 }
 
-void Renderer::Render(Scene &scene, const Camera &camera)
+bool Renderer::Render(Scene &scene, const Camera &camera)
 {
+	m_Settings.TileSize = std::max(m_Settings.TileSize, 1u);
+
+	// Nothing to do if the last frame was traced from the same scene, camera and settings
+	bool unchanged = m_FrameValid && m_ActiveScene == &scene && m_ActiveCamera == &camera &&
+		m_FrameSceneVersion == scene.GetVersion() && m_FrameCameraVersion == camera.GetVersion() && m_FrameSettings == m_Settings;
+	bool refining = m_Settings.Progressive && unchanged && m_PassScale > 1;
+	if (unchanged && m_Settings.Cache && !refining)
+		return false;
+
 	m_ActiveScene = &scene;
 	m_ActiveCamera = &camera;
-	
-	if (m_ActiveScene->GUI())
+
+	m_FrameValid = true;
+	m_FrameSceneVersion = scene.GetVersion();
+	m_FrameCameraVersion = camera.GetVersion();
+	m_FrameSettings = m_Settings;
+
+	// Shading only changes the colors, so the palette is rebuilt instead of the scene
+	UpdatePalette(*scene.GetNoiseSettings());
+
+	// Changes are traced at the motion scale, every unchanged frame after that halves it until all pixels are traced
+	if (refining)
+	{
+		m_TracedScale = m_PassScale;
+		m_PassScale /= 2;
+	}
+	else if (m_Settings.Progressive && !unchanged)
 	{
-		// Update the noise and get its maximum dimension
-		m_NoiseSettings = *scene.GetNoiseSettings();
-		m_ActiveScene->Noise = m_ActiveScene->PerlinNoiseGenerator.GetNoise();
-		uint32_t size = std::max((int)std::max(m_ActiveScene->NoiseWidth, m_ActiveScene->NoiseHeight), m_NoiseSettings.Height);
+		m_PassScale = m_MotionScale;
+		m_TracedScale = 0;
+	}
+	else
+	{
+		m_PassScale = 1;
+		m_TracedScale = 0;
+	}
 
-		// Set the points up for the scene
-		std::vector<glm::vec3> points(m_ActiveScene->Noise.size());
+	auto start = std::chrono::steady_clock::now();
+	uint64_t allocations = AllocationCounter::GetThreadCount();
 
-		for (int i = 0; i < points.size(); i++)
-		{
-			float x = i % m_ActiveScene->NoiseWidth;
-			float y = int(m_ActiveScene->Noise[i] * m_NoiseSettings.Height);
-			float z = i / m_ActiveScene->NoiseWidth;
-			
-			points[i] = glm::vec3(x + 0.5f, y + 0.5f, z + 0.5f);
-		}
+	m_RayOrigin = camera.GetPosition() - scene.Origin;
+	m_RayDirections = camera.GetRayDirections().empty() ? nullptr : camera.GetRayDirections().data();
+	m_RayBasis = camera.GetRayBasis();
+
+	// This if, else block will send out the rays for each tile and get the color of its pixels
+	size_t tilesX = (m_Width + m_Settings.TileSize - 1) / m_Settings.TileSize;
+	size_t tilesY = (m_Height + m_Settings.TileSize - 1) / m_Settings.TileSize;
 
-		// Generate the OcTree for the scene
-		m_ActiveScene->ocTree->Generate(size, points);
+	// Every tile counts its allocations on the thread that traces it, the calling thread's count covers the rest of the frame
+	m_TileAllocations = 0;
+	auto traceTile = [this](size_t tile)
+	{
+		uint64_t tileAllocations = AllocationCounter::GetThreadCount();
+		RenderTile(tile);
+		m_TileAllocations += AllocationCounter::GetThreadCount() - tileAllocations;
+	};
+	allocations = AllocationCounter::GetThreadCount() - allocations;
 
-		std::cout << "Noise and OcTree Generated" << '\n';
-		std::cout << "Dimension: " << size << 'x' << size << 'x' << size << '\n';
-		std::cout << "Noise Data Count: " << m_ActiveScene->Noise.size() << '\n';
-		std::cout << "Scene Octs Count: " << m_ActiveScene->ocTree->GetOctCount() << '\n';
-		std::cout << '\n';
+	if (m_Settings.Parallel) 
+	{
+		// Idle workers steal tiles from the busy ones, so tiles that hit a lot of the scene do not hold up the frame
+		ThreadPool::Get().ParallelFor(tilesX * tilesY, traceTile, m_Settings.Threads);
 	}
 
-	const std::vector<glm::vec3> rayDirections = camera.GetRayDirections();
-	// https://stackoverflow.com/questions/17694579/use-stdfill-to-populate-vector-with-increasing-numbers
-	// Code that creates and fills a vector of size n where the elements are 0,1,2,...,n - 1
-	std::vector<int> pixels(m_Width * m_Height); 
-	std::iota (std::begin(pixels), std::end(pixels), 0);
+	// Non parallelized for loop
+	else
+	{
+		for (size_t tile = 0; tile < tilesX * tilesY; tile++)
+			traceTile(tile);
+	}
 
+	allocations += m_TileAllocations;
+	uint64_t afterTiles = AllocationCounter::GetThreadCount();
 
-	// This if, else block will send out the rays for each pixel and get the color of that pixel
-	if (m_Settings.Parallel) 
+#ifndef PN_HEADLESS
+	// Set the image data
+	m_FinalImage->SetData(m_ColorBuffer);
+#endif
+
+	m_FrameAllocations = allocations + AllocationCounter::GetThreadCount() - afterTiles;
+
+	// Halving the scale traces four times the pixels, so only do it if that still fits in the target
+	if (m_Settings.Progressive && !refining)
 	{
-		std::for_each(std::execution::par, pixels.begin(), pixels.end(), [this](const int &pixel)
-			{
-				uint32_t x = pixel % m_Width;
-				uint32_t y = pixel / m_Width;
-				glm::vec4 color = PerPixel(x + y * m_Width);
+		float frameTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (frameTime > m_Settings.TargetFrameTime && m_MotionScale < Utils::MaxMotionScale)
+			m_MotionScale *= 2;
+		else if (frameTime * 4.0f < m_Settings.TargetFrameTime && m_MotionScale > 1)
+			m_MotionScale /= 2;
+	}
+	return true;
+}
 
-				color = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f));
-				m_ColorBuffer[x + y * m_Width] = Utils::ConvertToRGBA(color);
-			});
+#ifndef PN_HEADLESS
+std::shared_ptr<Walnut::Image> Renderer::GetFinalImage()
+{
+	return m_FinalImage;
+}
+#endif
+
+void Renderer::RenderTile(const size_t &tile)
+{
+	uint32_t size = m_Settings.TileSize;
+	size_t tilesX = (m_Width + size - 1) / size;
+
+	size_t minX = (tile % tilesX) * size;
+	size_t minY = (tile / tilesX) * size;
+	size_t maxX = std::min(minX + size, m_Width);
+	size_t maxY = std::min(minY + size, m_Height);
+
+	if (m_PassScale > 1 || m_TracedScale > 0)
+	{
+		RenderTilePass(minX, minY, maxX, maxY);
+		return;
 	}
 
-	// Non parallelized for loops
-	else
+	// Neighbouring primary rays walk nearly the same nodes, so the OcTree is walked by 2x2 blocks at a time
+	if (m_Settings.Packets && m_Settings.Noise && m_Settings.OcTree && !m_Settings.HeightField)
 	{
-		for (uint32_t y = 0; y < m_Height; y++)
+		for (size_t y = minY; y < maxY; y += 2)
 		{
-			for (uint32_t x = 0; x < m_Width; x++)
+			for (size_t x = minX; x < maxX; x += 2)
 			{
-				glm::vec4 color = PerPixel(x + y * m_Width);
-
-				color = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f));
-				m_ColorBuffer[x + y * m_Width] = Utils::ConvertToRGBA(color);
+				// Blocks on the right and bottom edge of the image can be missing pixels
+				uint32_t pixels[4];
+				int lanes = 0;
+				for (int i = 0; i < 4; i++)
+				{
+					size_t px = x + (i & 1);
+					size_t py = y + (i >> 1);
+					bool inside = px < maxX && py < maxY;
+
+					lanes |= inside ? (1 << i) : 0;
+					pixels[i] = inside ? (uint32_t)(px + py * m_Width) : pixels[0];
+				}
+
+				uint32_t colors[4];
+				PerPacket(pixels, lanes, colors);
+
+				for (int i = 0; i < 4; i++)
+				{
+					if (lanes & (1 << i))
+						m_ColorBuffer[pixels[i]] = colors[i];
+				}
 			}
 		}
+		return;
 	}
 
-	// Set the image data
-	m_FinalImage->SetData(m_ColorBuffer);
+	for (size_t y = minY; y < maxY; y++)
+	{
+		for (size_t x = minX; x < maxX; x++)
+		{
+			m_ColorBuffer[x + y * m_Width] = PerPixel((uint32_t)(x + y * m_Width));
+		}
+	}
 }
 
-std::shared_ptr<Walnut::Image> Renderer::GetFinalImage()
+void Renderer::RenderTilePass(const size_t &minX, const size_t &minY, const size_t &maxX, const size_t &maxY)
 {
-	return m_FinalImage;
+	// Blocks start at the tile's corner so they never spill into a neighbouring tile
+	uint32_t scale = m_PassScale;
+	uint32_t traced = m_TracedScale;
+	bool packets = m_Settings.Packets && m_Settings.Noise && m_Settings.OcTree && !m_Settings.HeightField;
+
+	uint32_t pixels[4];
+	int count = 0;
+
+	auto trace = [&]()
+	{
+		uint32_t colors[4];
+		if (packets)
+		{
+			for (int i = count; i < 4; i++)
+				pixels[i] = pixels[0];
+			PerPacket(pixels, (1 << count) - 1, colors);
+		}
+		else
+		{
+			for (int i = 0; i < count; i++)
+				colors[i] = PerPixel(pixels[i]);
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t color = colors[i];
+			size_t px = pixels[i] % m_Width;
+			size_t py = pixels[i] / m_Width;
+			for (size_t y = py; y < std::min(py + scale, maxY); y++)
+				std::fill(m_ColorBuffer + px + y * m_Width, m_ColorBuffer + std::min(px + scale, maxX) + y * m_Width, color);
+		}
+		count = 0;
+	};
+
+	for (size_t y = minY; y < maxY; y += scale)
+	{
+		for (size_t x = minX; x < maxX; x += scale)
+		{
+			// Pixels on the coarser grid of the earlier passes keep their color
+			if (traced && (x - minX) % traced == 0 && (y - minY) % traced == 0)
+				continue;
+
+			pixels[count++] = (uint32_t)(x + y * m_Width);
+			if (count == 4)
+				trace();
+		}
+	}
+
+	if (count > 0)
+		trace();
 }
 
-glm::vec4 Renderer::PerPixel(const uint32_t &pixel)
+glm::vec3 Renderer::RayDirection(const uint32_t &pixel) const
 {
-	glm::vec3 cameraPosition = m_ActiveCamera->GetPosition();
-	glm::vec3 cameraDirection = m_ActiveCamera->GetRayDirections()[pixel];
+	if (m_RayDirections)
+		return m_RayDirections[pixel];
+	return m_RayBasis.Direction(pixel % (uint32_t)m_Width, pixel / (uint32_t)m_Width);
+}
 
-	// Create the ray from the Camera position and direction to pixel
+uint32_t Renderer::PerPixel(const uint32_t &pixel)
+{
+	// Create the ray from the Camera position and direction to pixel, relative to the scene's origin
 	Ray ray;
-	ray.Origin = cameraPosition;
-	ray.Direction = cameraDirection;
+	ray.Origin = m_RayOrigin;
+	ray.Direction = RayDirection(pixel);
 
 	// Cast the ray into the scene
 	Renderer::HitData hitData = CastRay(ray);
-	
-	// Default color of the pixel
-	glm::vec3 color = glm::vec3(.55f, 0.8f, .50f);
 
-	float y = (hitData.WorldPosition.y - 0.5f) / m_NoiseSettings.Height;
+	return Shade(hitData);
+}
+
+void Renderer::PerPacket(const uint32_t pixels[4], const int &lanes, uint32_t colors[4])
+{
+	Ray rays[4];
+	for (int i = 0; i < 4; i++)
+		rays[i] = Ray(m_RayOrigin, RayDirection(pixels[i]));
+
+#ifdef PN_RAY_PACKETS
+	const OcTree &tree = *m_ActiveScene->ocTree;
+
+	float hitTimes[4];
+	uint32_t hitNodes[4];
+	std::fill(hitTimes, hitTimes + 4, std::numeric_limits<float>::max());
+	std::fill(hitNodes, hitNodes + 4, NoVoxel);
+	if (!tree.IsEmpty())
+		Utils::ScanChunksPacket(rays, lanes, tree, hitTimes, hitNodes);
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (!(lanes & (1 << i)))
+			continue;
 
+		if (hitNodes[i] == NoVoxel)
+			colors[i] = Shade(Miss(rays[i]));
+		else
+			colors[i] = Shade(ClosestHit(rays[i], hitTimes[i], tree.GetPoint(tree.GetNode(hitNodes[i]))));
+	}
+#else
+	// Without SIMD every ray is traced on its own
+	for (int i = 0; i < 4; i++)
+	{
+		if (lanes & (1 << i))
+			colors[i] = Shade(CastRay(rays[i]));
+	}
+#endif
+}
+
+uint32_t Renderer::Shade(const HitData &hitData) const
+{
 	// No hit color sky
 	if (hitData.HitTime < 0.0f)
-		color = glm::vec3(0.5f, 0.65f, 1.0f);
-
-	// Color based on noise value
-	else if (y < m_NoiseSettings.Water)
-		color = glm::vec3(.1f, 0.25f, 1.0f);
-	else if (y < m_NoiseSettings.Sand)
-		color = glm::vec3(0.7f, 0.7f, 0.3f);
-	else if (y > m_NoiseSettings.Snow)
-		color = glm::vec3(1.0f, 1.0f, 1.0f);
-	else if (y > m_NoiseSettings.Stone)
-		color = glm::vec3(0.2f, 0.2f, 0.2f);
-
-	return glm::vec4(color, 1.0f);
+		return Utils::SkyColor;
+
+	// Voxels sit in the middle of their level, which indexes the palette directly
+	return m_Palette.Get((int)(hitData.WorldPosition.y - 0.5f));
+}
+
+void Renderer::UpdatePalette(const NoiseSettings &settings)
+{
+	// Levels are relative to the height scale the voxels were placed with
+	NoiseSettings shading = settings;
+	shading.Height = m_VoxelHeight;
+	if (!m_Palette.IsEmpty() && shading == m_NoiseSettings)
+		return;
+
+	m_NoiseSettings = shading;
+	m_NoiseSettings.BuildPalette(m_Palette, Utils::TerrainColors);
 }
 
 Renderer::HitData Renderer::CastRay(const Ray &ray)
 {
-	if (m_Settings.Noise && m_Settings.OcTree)
+	if (m_Settings.Noise && m_Settings.HeightField)
 	{
-		// Checks all hit octs and returns the minimum time we hit a box of size 1x1x1 that contains a point
+		// Marches the columns of the heightfield instead of walking the OcTree
 		float hitTime = std::numeric_limits<float>::max();
 		glm::vec3 hitPoint = glm::vec3(hitTime);
-		Utils::ScanChunks(ray, m_ActiveScene->ocTree, hitTime, hitPoint); // hitTime is passed by reference
+
+		const HeightField &field = *m_ActiveScene->heightField;
+		if (!field.IsEmpty())
+			Utils::MarchHeightField(ray, field, hitTime, hitPoint);
 
 		if (hitTime == std::numeric_limits<float>::max())
 			return Miss(ray);
-		
+
 		return ClosestHit(ray, hitTime, hitPoint);
 	}
+
+	else if (m_Settings.Noise && m_Settings.OcTree)
+	{
+		// Checks all hit octs and returns the minimum time we hit a box of size 1x1x1 that contains a point
+		float hitTime = std::numeric_limits<float>::max();
+		uint32_t hitNode = NoVoxel;
+		const OcTree &tree = *m_ActiveScene->ocTree;
+		if (!tree.IsEmpty())
+			Utils::ScanChunks(ray, tree, hitTime, hitNode); // hitTime and hitNode are passed by reference
+
+		if (hitNode == NoVoxel)
+			return Miss(ray);
+		
+		return ClosestHit(ray, hitTime, tree.GetPoint(tree.GetNode(hitNode)));
+	}
 	
 	// Do not perform intersection tests if we do not want to render the noise map
 	else if (m_Settings.Noise)
@@ -230,19 +794,13 @@ Renderer::HitData Renderer::CastRay(const Ray &ray)
 		glm::vec3 hitPoint = glm::vec3(hitTime);
 		bool hit = false;
 
-		// Collects all of the 1x1x1 octs containing points in the scene
-		std::vector<OcTree*> blocks = {}; 
-		m_ActiveScene->ocTree->GetAllChildren(blocks);
-
-		for (const auto &block : blocks)
+		// Tests every 1x1x1 oct containing a point in the scene
+		const OcTree &tree = *m_ActiveScene->ocTree;
+		for (int i = 0; i < tree.GetPointCount(); i++)
 		{
-			if (block->GetSize() > 1)
-				continue;
-
-			const AABB &oct = block->GetOct();
-			std::vector<glm::vec3> boundaries = oct.GetBoundaries();
-
-			float t = Utils::RayAABBIntersection(ray, boundaries[0], boundaries[1]);
+			const glm::vec3 &point = tree.GetPoints()[i];
+			glm::vec3 boxMin = glm::floor(point);
+			float t = Utils::RayAABBIntersection(ray, boxMin, boxMin + 1.0f);
 
 			if (t < 0.0f)
 				continue;
@@ -250,7 +808,7 @@ Renderer::HitData Renderer::CastRay(const Ray &ray)
 			hit = true;
 			if (t < hitTime)
 			{
-				hitPoint = block->GetPoints()[0];
+				hitPoint = point;
 				hitTime = t;
 			}
 		}
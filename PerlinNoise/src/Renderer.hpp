@@ -1,13 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "Camera.hpp"
 #include "Ray.hpp"
 #include "Scene.hpp"
 #include "PerlinNoise.hpp"
 
+#ifndef PN_HEADLESS
 #include "Walnut/Image.h"
+#endif
 
 
 class Renderer
@@ -18,15 +22,63 @@ public:
 		bool  Parallel = true;
 		bool  Noise    = false;
 		bool  OcTree   = true;
+		bool  HeightField = false;
+
+		// Reuse the last frame when the scene, camera and settings have not changed since it was traced
+		bool  Cache    = true;
+
+		// Trace 2x2 blocks of pixels together when walking the OcTree
+		bool  Packets  = true;
+
+		// Parallel rendering splits the image into square tiles that are run on the shared thread pool
+		uint32_t TileSize = 32;
+		uint32_t Threads  = 0; // Most threads a frame is traced on, 0 uses the whole pool
+
+		// While the scene or camera changes only one pixel per block is traced and fills its block, the block size
+		// adapts so frames take about TargetFrameTime milliseconds. Unchanged frames then refine down to every pixel.
+		bool  Progressive = false;
+		float TargetFrameTime = 16.0f;
+
+
+		// Print the scene's size and memory use whenever it is rebuilt, does not change the frame
+		bool  Verbose = false;
+
+		bool operator==(const Settings &other) const
+		{
+			return Parallel == other.Parallel && Noise == other.Noise && OcTree == other.OcTree &&
+				HeightField == other.HeightField && Cache == other.Cache && Packets == other.Packets && TileSize == other.TileSize && Threads == other.Threads &&
+				Progressive == other.Progressive && TargetFrameTime == other.TargetFrameTime;
+		}
+		bool operator!=(const Settings &other) const { return !(*this == other); }
 	};
 
 public:
 	Renderer() = default;
 
 	void OnResize(uint32_t width, uint32_t height);
-	void Render(Scene &scene, const Camera &camera);
+	// Returns false if the last frame was reused instead of being traced again
+	bool Render(Scene &scene, const Camera &camera);
+
+	// Forces the next frame to be traced
+	void Invalidate() { m_FrameValid = false; }
+
+	// Rebuilds the scene points, OcTree and HeightField if the scene's noise or height scale changed since the
+	// last call, returns false if they were already up to date
+	bool UpdateScene(Scene &scene);
 
+#ifndef PN_HEADLESS
 	std::shared_ptr<Walnut::Image> GetFinalImage();
+#endif
+	const uint32_t *GetColorBuffer() const { return m_ColorBuffer; }
+
+	// Heap allocations made while the last frame was traced, on the calling thread and by every tile on the thread
+	// that traced it. Work other code runs on the pool meanwhile is not counted. Always 0 without PN_COUNT_ALLOCATIONS.
+	uint64_t GetFrameAllocations() const { return m_FrameAllocations; }
+
+	// Width and height of the blocks the last frame was traced at, 1 once every pixel has been traced
+	uint32_t GetPassScale() const { return m_PassScale; }
+	size_t GetWidth() const { return m_Width; }
+	size_t GetHeight() const { return m_Height; }
 	
 	Settings &GetSettings() { return m_Settings; }
 private:
@@ -35,8 +87,29 @@ private:
 		float HitTime;
 		glm::vec3 WorldPosition;
 	};
+
+	// Leaf index the OcTree walk reports for a ray that hit nothing
+	static constexpr uint32_t NoVoxel = 0xffffffff;
 	
-	glm::vec4 PerPixel(const uint32_t &pixel);
+	// Traces every pixel of one tile, tiles are numbered row by row
+	void RenderTile(const size_t &tile);
+
+	// Traces the pixels of one progressive pass in the tile and fills the block below and right of each one
+	void RenderTilePass(const size_t &minX, const size_t &minY, const size_t &maxX, const size_t &maxY);
+
+	uint32_t PerPixel(const uint32_t &pixel);
+
+	// Direction of the ray through pixel, from the camera's cache or derived from its basis
+	glm::vec3 RayDirection(const uint32_t &pixel) const;
+
+	// Traces the pixels of a 2x2 block as one packet of rays, lanes has a bit set for each pixel to trace
+	void PerPacket(const uint32_t pixels[4], const int &lanes, uint32_t colors[4]);
+
+	// Colors a pixel based on the height of the voxel its ray hit, packed as 0xAABBGGRR
+	uint32_t Shade(const HitData &hitData) const;
+
+	// Rebuilds the palette if the shading thresholds or the height scale changed since it was built
+	void UpdatePalette(const NoiseSettings &settings);
 
 	// Function that casts a ray out into the world space
 	HitData CastRay(const Ray &ray);
@@ -52,13 +125,48 @@ private:
 	const Camera *m_ActiveCamera = nullptr;
 	Settings m_Settings;
 
+#ifndef PN_HEADLESS
 	std::shared_ptr<Walnut::Image> m_FinalImage;
+#endif
 	uint32_t *m_ColorBuffer = nullptr;
 
+	// Ray origin and directions of the frame being traced, read once per frame instead of per pixel.
+	// m_RayDirections is nullptr if the camera does not cache them, then they are derived from m_RayBasis.
+	glm::vec3 m_RayOrigin{ 0.0f };
+	const glm::vec3 *m_RayDirections = nullptr;
+	Camera::RayBasis m_RayBasis;
+
+	uint64_t m_FrameAllocations = 0;
+	std::atomic<uint64_t> m_TileAllocations{ 0 };
+
+	// What the last traced frame was made from
+	bool m_FrameValid = false;
+	uint64_t m_FrameSceneVersion = 0;
+	uint64_t m_FrameCameraVersion = 0;
+	Settings m_FrameSettings;
+
+	// Progressive rendering traces the pixels on multiples of m_PassScale from the tile's corner, skipping the
+	// ones on multiples of m_TracedScale that earlier passes traced already (0 if there are none)
+	uint32_t m_PassScale = 1;
+	uint32_t m_TracedScale = 0;
+	uint32_t m_MotionScale = 2;
+
 	size_t m_Width = 0;
 	size_t m_Height = 0;
 
+	// Stage versions of the scene the OcTree and HeightField were last built from
+	const Scene *m_BuiltScene = nullptr;
+	uint64_t m_BuiltNoiseVersion = 0;
+	uint64_t m_BuiltHeightVersion = 0;
+
+	// Points of the last build, kept so rebuilds reuse their storage
+	std::vector<glm::vec3> m_Points;
+
+	// Height scale the voxels were placed with, and the shading settings the palette of its levels was built from.
+	// The settings are read from the scene every frame, the palette only changes with them.
+	int m_VoxelHeight = 1;
 	NoiseSettings m_NoiseSettings;
+	ShadingPalette m_Palette;
 	//size_t m_NoiseHeight = 32;
 };
 
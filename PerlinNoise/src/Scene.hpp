@@ -1,37 +1,244 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include "PerlinNoise.hpp"
+#include "ChunkManager.hpp"
 #include "AABB.hpp"
 #include "OcTree.hpp"
+#include "HeightField.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
 
 struct Scene
 {
 	OcTree *ocTree = new OcTree();
-	PerlinNoiseGenerator PerlinNoiseGenerator{ 0, 32, 32, 16, 2, 0.15f };
+	HeightField *heightField = new HeightField();
+	::PerlinNoiseGenerator PerlinNoiseGenerator{ 0, 32, 32, 16, 2, 0.15f };
 	std::vector<double> Noise = {};
 
 	size_t NoiseWidth = 0;
 	size_t NoiseHeight = 0;
 
+	// When streaming, Noise holds the chunks around the camera and Origin is the world position of its first sample
+	ChunkManager Chunks;
+	bool Streaming = false;
+	glm::vec3 Origin{ 0.0f };
+
+	// When animated, the generated map moves AnimationSpeed noise cells through time every second
+	bool Animated = false;
+	float AnimationSpeed = 0.5f;
+	double AnimationTime = 0.0;
+
+	// Scene file the OcTree and HeightField point into when they were loaded instead of built
+	std::unique_ptr<MappedFile> File;
+
+#ifndef PN_HEADLESS
 	bool GUI()
 	{
 		return PerlinNoiseGenerator.GUI(NoiseWidth, NoiseHeight);
 	}
+#endif
+
+	// Uses the map made by the generator as the scene's noise, returns true if the noise changed
+	bool UseGeneratedNoise()
+	{
+		if (m_GeneratedVersion == PerlinNoiseGenerator.GetVersion() && m_GeneratedVersion > 0)
+			return false;
+
+		m_GeneratedVersion = PerlinNoiseGenerator.GetVersion();
+		Noise = PerlinNoiseGenerator.GetNoise();
+		NoiseWidth = (size_t)PerlinNoiseGenerator.GetWidth();
+		NoiseHeight = (size_t)PerlinNoiseGenerator.GetHeight();
+		Origin = glm::vec3(0.0f);
+		InvalidateNoise();
+		return true;
+	}
+
+	// Takes a map whose OcTree and HeightField were loaded along with it, so they are not built again. The generator
+	// takes the map over with the parameters it was made from, so saving writes them back and the previews show it.
+	void UseLoadedNoise(const int &seed, const int &cellsize, const int &levels, const double &attenuation)
+	{
+		PerlinNoiseGenerator.UseNoise(seed, (int)NoiseWidth, (int)NoiseHeight, cellsize, levels, attenuation, Noise);
+		m_GeneratedVersion = PerlinNoiseGenerator.GetVersion();
+		InvalidateNoise();
+		InvalidateHeight();
+		SetBuilt();
+	}
+
+	// Streams the chunks around position into the scene, returns true if the noise changed. The window is built
+	// into its own OcTree and HeightField on the thread pool and swapped in once done, chunks that arrive
+	// meanwhile are batched into the next build.
+	bool Stream(const glm::vec3 &position)
+	{
+		Chunks.SetParameters(PerlinNoiseGenerator.GetSeed(), PerlinNoiseGenerator.GetCellSize(),
+			PerlinNoiseGenerator.GetLevels(), PerlinNoiseGenerator.GetAttenuation());
+
+		if (Chunks.Update(position))
+			m_StreamChanged = true;
+
+		bool changed = m_StreamBuild && m_StreamBuild->Done && UseStreamBuild();
+		if (m_StreamChanged && !m_StreamBuild)
+			BuildStreamWindow();
+		return changed;
+	}
+
+	// True while a streamed window is being built
+	bool IsStreamBuilding() const { return m_StreamBuild != nullptr; }
+
+	// Drops the window being built and goes back to the generator's map, the next Stream builds the window again
+	bool StopStreaming()
+	{
+		m_StreamBuild.reset();
+		m_StreamChanged = true;
+		return UseGeneratedNoise();
+	}
+
+	// Advances the animation by ts seconds. The next frame is generated in the background while the current one
+	// is rendered, returns true if a finished frame replaced the scene's noise.
+	bool Animate(const float &ts)
+	{
+		AnimationTime += (double)ts * AnimationSpeed;
+
+		bool swapped = PerlinNoiseGenerator.SwapFrame();
+		PerlinNoiseGenerator.GenerateFrameAsync(AnimationTime);
+		return swapped && UseGeneratedNoise();
+	}
+
+	// Places a point in the center of the voxel at the top of each noise column, skipping columns without noise
+	void GeneratePoints(std::vector<glm::vec3> &points, const int &height) const
+	{
+		GeneratePoints(Noise, NoiseWidth, height, points);
+	}
+
+	static void GeneratePoints(const std::vector<double> &noise, const size_t &width, const int &height, std::vector<glm::vec3> &points)
+	{
+		points.clear();
+		points.reserve(noise.size());
+
+		for (size_t i = 0; i < noise.size(); i++)
+		{
+			if (noise[i] < 0.0)
+				continue;
+
+			float x = i % width;
+			float y = int(noise[i] * height);
+			float z = i / width;
+
+			points.push_back(glm::vec3(x + 0.5f, y + 0.5f, z + 0.5f));
+		}
+	}
 
 	NoiseSettings *GetNoiseSettings() { return PerlinNoiseGenerator.GetNoiseSettings(); }
-	void SetNoiseHeight(const int   &height)  { PerlinNoiseGenerator.SetHeight(height); }
-	void SetNoiseWater (const float &water )  { PerlinNoiseGenerator.SetWater(water);   }
-	void SetNoiseSand  (const float &sand  )  { PerlinNoiseGenerator.SetSand(sand);     }
-	void SetNoiseStone (const float &stone )  { PerlinNoiseGenerator.SetStone(stone);   }
-	void SetNoiseSnow  (const float &snow  )  { PerlinNoiseGenerator.SetSnow(snow);     }
+	const NoiseSettings *GetNoiseSettings() const { return PerlinNoiseGenerator.GetNoiseSettings(); }
+	void SetNoiseHeight(const int   &height)  { PerlinNoiseGenerator.SetHeight(height); InvalidateHeight(); }
+	void SetNoiseWater (const float &water )  { PerlinNoiseGenerator.SetWater(water);   Invalidate(); }
+	void SetNoiseSand  (const float &sand  )  { PerlinNoiseGenerator.SetSand(sand);     Invalidate(); }
+	void SetNoiseStone (const float &stone )  { PerlinNoiseGenerator.SetStone(stone);   Invalidate(); }
+	void SetNoiseSnow  (const float &snow  )  { PerlinNoiseGenerator.SetSnow(snow);     Invalidate(); }
 	const int GetNoiseHeight() const { return PerlinNoiseGenerator.GetNoiseHeight(); }
-	
+
+	// Changes every time something that affects the rendered image changes
+	uint64_t GetVersion() const { return m_Version; }
+	void Invalidate() { m_Version++; }
+
+	// Each stage of the scene has its own version so only the stages after a change are rebuilt:
+	// the noise feeds the voxels, the height scale places them, and shading only needs a new frame
+	uint64_t GetNoiseVersion() const { return m_NoiseVersion; }
+	uint64_t GetHeightVersion() const { return m_HeightVersion; }
+	void InvalidateNoise() { m_NoiseVersion++; Invalidate(); }
+	void InvalidateHeight() { m_HeightVersion++; Invalidate(); }
+
+	// True if the OcTree and HeightField were built or loaded for the current noise and height scale
+	bool IsBuilt() const { return m_BuiltNoiseVersion == m_NoiseVersion && m_BuiltHeightVersion == m_HeightVersion; }
+	void SetBuilt() { m_BuiltNoiseVersion = m_NoiseVersion; m_BuiltHeightVersion = m_HeightVersion; }
 
 	~Scene()
 	{
 		// No memory leak please
 		delete ocTree;
+		delete heightField;
 	}
+
+private:
+	// A streamed window with the OcTree and HeightField built for it on the thread pool
+	struct StreamBuild
+	{
+		std::vector<double> Noise;
+		size_t Width = 0;
+		size_t Height = 0;
+		glm::vec3 Origin{ 0.0f };
+		uint64_t HeightVersion = 0;
+		std::unique_ptr<OcTree> Tree = std::make_unique<OcTree>();
+		std::unique_ptr<HeightField> Field = std::make_unique<HeightField>();
+		std::atomic<bool> Done{ false };
+	};
+
+	void BuildStreamWindow()
+	{
+		auto build = std::make_shared<StreamBuild>();
+		glm::ivec2 origin;
+		Chunks.GetWindow(build->Noise, build->Width, build->Height, origin);
+		build->Origin = glm::vec3((float)origin.x, 0.0f, (float)origin.y);
+		build->HeightVersion = m_HeightVersion;
+
+		// The task owns everything it builds, so the scene can go away or drop it while it runs
+		int height = std::max(GetNoiseHeight(), 1);
+		ThreadPool::Get().Submit([build, height]()
+			{
+				std::vector<glm::vec3> points;
+				GeneratePoints(build->Noise, build->Width, height, points);
+				build->Tree->Generate((uint32_t)std::max((int)std::max(build->Width, build->Height), height), points);
+				build->Field->Generate(build->Noise, build->Width, build->Height, height);
+				build->Done = true;
+			});
+
+		m_StreamBuild = build;
+		m_StreamChanged = false;
+	}
+
+	bool UseStreamBuild()
+	{
+		std::shared_ptr<StreamBuild> build = std::move(m_StreamBuild);
+
+		// Voxels built for another height scale are in the wrong place, so the window is built again
+		if (build->HeightVersion != m_HeightVersion)
+		{
+			m_StreamChanged = true;
+			return false;
+		}
+
+		Noise.swap(build->Noise);
+		NoiseWidth = build->Width;
+		NoiseHeight = build->Height;
+		Origin = build->Origin;
+
+		// The old OcTree and HeightField are freed along with the build
+		OcTree *tree = ocTree;
+		ocTree = build->Tree.release();
+		build->Tree.reset(tree);
+		HeightField *field = heightField;
+		heightField = build->Field.release();
+		build->Field.reset(field);
+		File.reset();
+
+		// The window no longer holds the generator's map, so switching back has to copy it again
+		m_GeneratedVersion = 0;
+		InvalidateNoise();
+		SetBuilt();
+		return true;
+	}
+
+private:
+	std::shared_ptr<StreamBuild> m_StreamBuild;
+	bool m_StreamChanged = false;
+
+	uint64_t m_Version = 0;
+	uint64_t m_NoiseVersion = 0;
+	uint64_t m_HeightVersion = 0;
+	uint64_t m_GeneratedVersion = 0;
+	uint64_t m_BuiltNoiseVersion = 0;
+	uint64_t m_BuiltHeightVersion = 0;
 };
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include "SceneFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace Utils
+{
+	// "PNSC" read as a little endian integer, files written with the other byte order fail this check
+	static constexpr uint32_t SceneMagic = 0x43534e50;
+
+	// Sections start on cache line boundaries, the mapping itself starts on a page boundary
+	static constexpr uint64_t SectionAlignment = 64;
+
+	struct SceneHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t HeaderSize;
+		uint32_t OcTreeSize;
+
+		// Generator parameters, the map is Width x Depth samples
+		int32_t  Seed;
+		int32_t  CellSize;
+		int32_t  Levels;
+		uint32_t Width;
+		uint32_t Depth;
+		uint32_t Padding;
+		double   Attenuation;
+
+		// NoiseSettings, the OcTree and HeightField were built with this voxel height
+		int32_t Color;
+		int32_t Height;
+		float   Water;
+		float   Sand;
+		float   Stone;
+		float   Snow;
+
+		// Sections as byte offsets from the start of the file and item counts
+		uint64_t HeightsOffset; // uint16_t per sample
+		uint64_t NodesOffset;   // OcTree::Node
+		uint64_t NodeCount;
+		uint64_t PointsOffset;  // glm::vec3 per leaf
+		uint64_t PointCount;
+		uint64_t RangesOffset;  // HeightField::Range of every level
+		uint64_t RangeCount;
+		uint64_t FileSize;
+	};
+
+	// The sections are used in place, so their layout must not depend on the compiler
+	static_assert(sizeof(SceneHeader) == 136, "Scene header has padding");
+	static_assert(sizeof(OcTree::Node) == 8 && std::is_trivially_copyable<OcTree::Node>::value, "OcTree nodes changed layout");
+	static_assert(sizeof(glm::vec3) == 12 && std::is_trivially_copyable<glm::vec3>::value, "Points changed layout");
+	static_assert(sizeof(HeightField::Range) == 8 && std::is_trivially_copyable<HeightField::Range>::value, "Ranges changed layout");
+
+	static uint64_t AlignSection(const uint64_t &offset)
+	{
+		return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+	}
+
+	// True if count items of size bytes at offset are aligned and inside the file
+	static bool IsSectionValid(const uint64_t &offset, const uint64_t &count, const size_t &size, const uint64_t &fileSize)
+	{
+		return offset % SectionAlignment == 0 && offset <= fileSize && count <= (fileSize - offset) / size;
+	}
+
+	// Writes the section at offset, padding the file with zeros from position up to it
+	static bool WriteSection(FILE *file, uint64_t &position, const uint64_t &offset, const void *data, const size_t &bytes)
+	{
+		static const char zeros[SectionAlignment] = {};
+		if (offset < position || offset - position > SectionAlignment)
+			return false;
+		if (std::fwrite(zeros, 1, (size_t)(offset - position), file) != offset - position)
+			return false;
+		if (bytes && std::fwrite(data, 1, bytes, file) != bytes)
+			return false;
+
+		position = offset + bytes;
+		return true;
+	}
+
+	// Copies the nodes in blocks through a zeroed buffer, so the padding after ChildMask is written as zeros
+	static bool WriteNodes(FILE *file, const OcTree &tree)
+	{
+		constexpr size_t BlockSize = 4096;
+		std::vector<OcTree::Node> block(BlockSize);
+		std::memset((void*)block.data(), 0, BlockSize * sizeof(OcTree::Node));
+
+		size_t count = (size_t)tree.GetOctCount();
+		for (size_t first = 0; first < count; first += BlockSize)
+		{
+			size_t blockCount = std::min(BlockSize, count - first);
+			for (size_t i = 0; i < blockCount; i++)
+			{
+				block[i].Index = tree.GetNodes()[first + i].Index;
+				block[i].ChildMask = tree.GetNodes()[first + i].ChildMask;
+			}
+
+			if (std::fwrite(block.data(), sizeof(OcTree::Node), blockCount, file) != blockCount)
+				return false;
+		}
+		return true;
+	}
+
+	// Nodes are laid out level by level from the root, so every child comes after its parent. Checking that, and that
+	// no node is deeper than a tree of this size can be, keeps the renderer's walk inside the sections and its stack.
+	static bool IsOcTreeValid(const uint32_t &size, const OcTree::Node *nodes, const uint64_t &nodeCount, const uint64_t &pointCount)
+	{
+		uint8_t maxDepth = 0;
+		while ((1u << maxDepth) < size)
+			maxDepth++;
+
+		std::vector<uint8_t> depths((size_t)nodeCount, 0);
+		for (uint64_t i = 0; i < nodeCount; i++)
+		{
+			const OcTree::Node &node = nodes[i];
+			if (node.ChildMask == 0)
+			{
+				if (node.Index >= pointCount)
+					return false;
+				continue;
+			}
+
+			uint64_t children = 0;
+			for (uint32_t bits = node.ChildMask; bits; bits &= bits - 1)
+				children++;
+			if (node.Index <= i || node.Index + children > nodeCount || depths[i] >= maxDepth)
+				return false;
+
+			for (uint64_t child = node.Index; child < node.Index + children; child++)
+				depths[child] = std::max(depths[child], (uint8_t)(depths[i] + 1));
+		}
+		return true;
+	}
+
+	// Moves from over to. A scene mapped from to keeps it open, with FILE_SHARE_DELETE on Windows, so there it is renamed
+	// out of the way if it cannot be replaced directly. Its pages stay valid until the mapping is closed either way.
+	static bool RenameOver(const std::string &from, const std::string &to)
+	{
+#ifdef _WIN32
+		if (MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING))
+			return true;
+
+		std::string old = to + ".old";
+		if (!MoveFileExA(to.c_str(), old.c_str(), MOVEFILE_REPLACE_EXISTING))
+			return false;
+		if (!MoveFileExA(from.c_str(), to.c_str(), 0))
+		{
+			MoveFileExA(old.c_str(), to.c_str(), 0);
+			return false;
+		}
+
+		// Deleted once the mapping is closed
+		DeleteFileA(old.c_str());
+		return true;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	static bool WriteScene(FILE *file, const SceneHeader &header, const std::vector<uint16_t> &heights, const OcTree &tree, const HeightField &field)
+	{
+		uint64_t position = 0;
+		if (!WriteSection(file, position, 0, &header, sizeof(header)))
+			return false;
+		if (!WriteSection(file, position, header.HeightsOffset, heights.data(), heights.size() * sizeof(uint16_t)))
+			return false;
+
+		if (!WriteSection(file, position, header.NodesOffset, nullptr, 0) || !WriteNodes(file, tree))
+			return false;
+		position += header.NodeCount * sizeof(OcTree::Node);
+
+		if (!WriteSection(file, position, header.PointsOffset, tree.GetPoints(), (size_t)header.PointCount * sizeof(glm::vec3)))
+			return false;
+
+		// The levels are stored one after the other, the way HeightField::View reads them
+		for (int level = 0; level < field.GetLevelCount(); level++)
+		{
+			size_t bytes = (size_t)field.GetWidth(level) * field.GetDepth(level) * sizeof(HeightField::Range);
+			uint64_t offset = level == 0 ? header.RangesOffset : position;
+			if (!WriteSection(file, position, offset, field.GetRanges(level), bytes))
+				return false;
+		}
+
+		return position == header.FileSize;
+	}
+}
+
+bool SceneFile::Write(const std::string &path, const Scene &scene)
+{
+	size_t width = scene.NoiseWidth;
+	size_t depth = scene.NoiseHeight;
+	const OcTree &tree = *scene.ocTree;
+	const HeightField &field = *scene.heightField;
+	if (scene.Streaming || !scene.IsBuilt() || width == 0 || depth == 0 || scene.Noise.size() != width * depth || field.IsEmpty())
+		return false;
+
+	const PerlinNoiseGenerator &generator = scene.PerlinNoiseGenerator;
+	const NoiseSettings &settings = *scene.GetNoiseSettings();
+
+	Utils::SceneHeader header = {};
+	header.Magic = Utils::SceneMagic;
+	header.Version = Version;
+	header.HeaderSize = sizeof(Utils::SceneHeader);
+	header.OcTreeSize = tree.GetSize();
+	header.Seed = generator.GetSeed();
+	header.CellSize = generator.GetCellSize();
+	header.Levels = generator.GetLevels();
+	header.Width = (uint32_t)width;
+	header.Depth = (uint32_t)depth;
+	header.Attenuation = generator.GetAttenuation();
+	header.Color = settings.Color ? 1 : 0;
+	header.Height = std::max(settings.Height, 1);
+	header.Water = settings.Water;
+	header.Sand = settings.Sand;
+	header.Stone = settings.Stone;
+	header.Snow = settings.Snow;
+
+	header.HeightsOffset = Utils::AlignSection(sizeof(Utils::SceneHeader));
+	header.NodesOffset = Utils::AlignSection(header.HeightsOffset + width * depth * sizeof(uint16_t));
+	header.NodeCount = (uint64_t)tree.GetOctCount();
+	header.PointsOffset = Utils::AlignSection(header.NodesOffset + header.NodeCount * sizeof(OcTree::Node));
+	header.PointCount = (uint64_t)tree.GetPointCount();
+	header.RangesOffset = Utils::AlignSection(header.PointsOffset + header.PointCount * sizeof(glm::vec3));
+	header.RangeCount = HeightField::GetRangeCount(width, depth);
+	header.FileSize = header.RangesOffset + header.RangeCount * sizeof(HeightField::Range);
+
+	std::vector<uint16_t> heights(width * depth);
+	ThreadPool::Get().ParallelFor(depth, [&](size_t z)
+		{
+			for (size_t x = 0; x < width; x++)
+				heights[x + z * width] = PerlinNoiseGenerator::QuantizeHeight(scene.Noise[x + z * width]);
+		});
+
+	// Written next to the destination and renamed over it, so a failed write leaves the old file in place
+	std::string temporary = path + ".tmp";
+	FILE *file = std::fopen(temporary.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool written = Utils::WriteScene(file, header, heights, tree, field);
+	written = std::fclose(file) == 0 && written;
+	written = written && Utils::RenameOver(temporary, path);
+
+	if (!written)
+		std::remove(temporary.c_str());
+	return written;
+}
+
+bool SceneFile::Load(const std::string &path, Scene &scene)
+{
+	auto file = std::make_unique<MappedFile>();
+	if (!file->Open(path) || file->GetSize() < sizeof(Utils::SceneHeader))
+		return false;
+
+	// The mapping starts on a page boundary, so the header and every section are aligned where they are
+	const uint8_t *data = file->GetData();
+	const Utils::SceneHeader &header = *(const Utils::SceneHeader*)data;
+	uint64_t fileSize = (uint64_t)file->GetSize();
+
+	if (header.Magic != Utils::SceneMagic || header.Version != Version || header.HeaderSize != sizeof(Utils::SceneHeader) || header.FileSize != fileSize)
+		return false;
+
+	// Everything the renderer indexes by has to fit the sections
+	uint64_t width = header.Width;
+	uint64_t depth = header.Depth;
+	bool powerOfTwo = header.OcTreeSize > 0 && (header.OcTreeSize & (header.OcTreeSize - 1)) == 0;
+	if (width == 0 || depth == 0 || width > (uint64_t)std::numeric_limits<int>::max() || depth > (uint64_t)std::numeric_limits<int>::max() ||
+		header.Height < 1 || !powerOfTwo || header.PointCount > header.NodeCount ||
+		(header.NodeCount == 0) != (header.PointCount == 0) || header.RangeCount != HeightField::GetRangeCount(width, depth))
+		return false;
+
+	if (!Utils::IsSectionValid(header.HeightsOffset, width * depth, sizeof(uint16_t), fileSize) ||
+		!Utils::IsSectionValid(header.NodesOffset, header.NodeCount, sizeof(OcTree::Node), fileSize) ||
+		!Utils::IsSectionValid(header.PointsOffset, header.PointCount, sizeof(glm::vec3), fileSize) ||
+		!Utils::IsSectionValid(header.RangesOffset, header.RangeCount, sizeof(HeightField::Range), fileSize))
+		return false;
+
+	// The generator takes these parameters over, so they have to be ones it can generate from
+	if (header.CellSize < 1 || header.Levels < 1 || !std::isfinite(header.Attenuation) || header.Attenuation <= 0.0)
+		return false;
+
+	const OcTree::Node *nodes = (const OcTree::Node*)(data + header.NodesOffset);
+	if (!Utils::IsOcTreeValid(header.OcTreeSize, nodes, header.NodeCount, header.PointCount))
+		return false;
+
+	// A streamed or animated scene would replace the loaded map on the next frame. Stopping the animation would
+	// generate the static map again, which would replace it too, so the generator only drops its frames.
+	scene.Streaming = false;
+	scene.Animated = false;
+
+	NoiseSettings &settings = *scene.GetNoiseSettings();
+	settings.Color = header.Color != 0;
+	settings.Height = header.Height;
+	settings.Water = header.Water;
+	settings.Sand = header.Sand;
+	settings.Stone = header.Stone;
+	settings.Snow = header.Snow;
+
+	const uint16_t *heights = (const uint16_t*)(data + header.HeightsOffset);
+	scene.Noise.resize(width * depth);
+	ThreadPool::Get().ParallelFor(depth, [&](size_t z)
+		{
+			for (size_t x = 0; x < width; x++)
+				scene.Noise[x + z * width] = PerlinNoiseGenerator::DequantizeHeight(heights[x + z * width]);
+		});
+	scene.NoiseWidth = width;
+	scene.NoiseHeight = depth;
+	scene.Origin = glm::vec3(0.0f);
+
+	scene.ocTree->View(header.OcTreeSize, nodes, header.NodeCount,
+		(const glm::vec3*)(data + header.PointsOffset), header.PointCount);
+	scene.heightField->View(width, depth, (const HeightField::Range*)(data + header.RangesOffset));
+
+	scene.File = std::move(file);
+	scene.UseLoadedNoise(header.Seed, header.CellSize, header.Levels, header.Attenuation);
+	return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Scene.hpp"
+
+// Binary scene files hold a fixed map with everything needed to trace it: the noise quantised to 16 bits, the
+// generator parameters and NoiseSettings it was made with, and the OcTree and HeightField built from it.
+// Every section is stored in the layout the renderer reads, so loading maps the file and points the scene's
+// OcTree and HeightField at its pages without parsing or copying them. Files use the writer's byte order.
+namespace SceneFile
+{
+	// Changes whenever the layout does, files of any other version are rejected
+	static constexpr uint32_t Version = 1;
+
+	// Returns false if the scene is streamed, its OcTree and HeightField are out of date, or the file could not be written
+	bool Write(const std::string &path, const Scene &scene);
+
+	// Returns false and leaves the scene unchanged if the file is missing, not a scene file of this version, or its OcTree
+	// points outside of its sections. The noise is expanded back to doubles so the height scale can still be changed,
+	// which rebuilds the scene. The generator takes the map over with its parameters, after any noise it is generating.
+	bool Load(const std::string &path, Scene &scene);
+}
@@ -0,0 +1,26 @@
+#include "ShadingPalette.hpp"
+
+void ShadingPalette::Reset(const int &maxLevel, const uint32_t &color)
+{
+	m_MaxLevel = std::max(maxLevel, 0);
+	m_Colors.assign((size_t)m_MaxLevel + 1, color);
+}
+
+void ShadingPalette::AddBand(const float &from, const float &to, const uint32_t &color)
+{
+	// Classified in float, so a level exactly on a threshold lands in the same band in the scene and the preview
+	float maxLevel = (float)std::max(m_MaxLevel, 1);
+	for (int level = 0; level <= m_MaxLevel; level++)
+	{
+		float y = (float)level / maxLevel;
+		if (y > from && y < to)
+			m_Colors[level] = color;
+	}
+}
+
+void ShadingPalette::BuildGrayscale()
+{
+	Reset(255, 0);
+	for (uint32_t level = 0; level <= 255; level++)
+		m_Colors[level] = 0xff000000 | (level << 16) | (level << 8) | level;
+}
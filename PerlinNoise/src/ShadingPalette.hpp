@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Color of every voxel level of a map, packed as 0xAABBGGRR. Terrain is classified once per level when the palette
+// is built, so shading a sample is a single lookup however many bands the palette was painted with.
+class ShadingPalette
+{
+public:
+	// Colors of the terrain classes the shading settings paint
+	struct TerrainColors
+	{
+		uint32_t Water;
+		uint32_t Sand;
+		uint32_t Grass;
+		uint32_t Stone;
+		uint32_t Snow;
+	};
+
+	// Sets levels 0 to maxLevel to color
+	void Reset(const int &maxLevel, const uint32_t &color);
+
+	// Paints color over the levels whose height, as a fraction of the max level, is above from and below to.
+	// Bands painted later take precedence.
+	void AddBand(const float &from, const float &to, const uint32_t &color);
+
+	// One gray level per 8 bit intensity
+	void BuildGrayscale();
+
+	bool IsEmpty() const { return m_Colors.empty(); }
+	int GetMaxLevel() const { return m_MaxLevel; }
+	const uint32_t* GetData() const { return m_Colors.data(); }
+
+	// Levels outside the map take the color of the closest one
+	uint32_t Get(const int &level) const { return m_Colors[std::clamp(level, 0, m_MaxLevel)]; }
+
+private:
+	std::vector<uint32_t> m_Colors;
+	int m_MaxLevel = 0;
+};
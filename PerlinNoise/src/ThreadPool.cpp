@@ -0,0 +1,229 @@
+#include "ThreadPool.hpp"
+
+namespace Utils
+{
+	// Lets a worker find its own queue when it submits more work
+	static thread_local const ThreadPool *s_WorkerPool = nullptr;
+	static thread_local size_t s_WorkerIndex = 0;
+}
+
+ThreadPool::ThreadPool(const uint32_t &threadCount)
+{
+	Start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	Stop();
+}
+
+ThreadPool &ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	// Workers keep their own tasks local, other threads spread them over the queues
+	size_t queue = (Utils::s_WorkerPool == this) ? Utils::s_WorkerIndex : m_NextQueue++ % m_Queues.size();
+	Push(queue, { std::move(task), nullptr });
+}
+
+void ThreadPool::ParallelFor(const size_t &count, const std::function<void(size_t)> &job)
+{
+	if (count == 0)
+		return;
+
+	// Run small jobs inline
+	if (count == 1 || m_Workers.size() < 2)
+	{
+		for (size_t i = 0; i < count; i++)
+			job(i);
+		return;
+	}
+
+	Batch batch;
+	batch.Job = &job;
+	batch.Remaining = count;
+
+	// Deal the indices out round robin so every worker starts with a share to steal from
+	size_t first = m_NextQueue.fetch_add(1);
+	for (size_t i = 0; i < count; i++)
+	{
+		Task task;
+		task.Parent = &batch;
+		task.Index = i;
+		Push((first + i) % m_Queues.size(), std::move(task));
+	}
+
+	// Help out with this batch until none of its indices are left in the queues
+	size_t self = (Utils::s_WorkerPool == this) ? Utils::s_WorkerIndex : 0;
+	Task task;
+	while (batch.Remaining > 0 && (PopLocal(self, task, &batch) || Steal(self, task, &batch)))
+	{
+		m_Pending--;
+		Run(task);
+	}
+
+	// The rest of the batch is running on other threads
+	std::unique_lock<std::mutex> lock(batch.Mutex);
+	batch.Finished.wait(lock, [&batch]() { return batch.Done; });
+}
+
+void ThreadPool::ParallelFor(const size_t &count, const std::function<void(size_t)> &job, const uint32_t &maxThreads)
+{
+	if (maxThreads == 0 || maxThreads >= count)
+	{
+		ParallelFor(count, job);
+		return;
+	}
+
+	// Each of the maxThreads tasks keeps taking indices, so the load still balances
+	std::atomic<size_t> next{ 0 };
+	ParallelFor(maxThreads, [&](size_t)
+	{
+		for (size_t i = next++; i < count; i = next++)
+			job(i);
+	});
+}
+
+void ThreadPool::Start(const uint32_t &threadCount)
+{
+	uint32_t count = threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+
+	m_Queues.clear();
+	for (uint32_t i = 0; i < count; i++)
+		m_Queues.push_back(std::make_unique<WorkQueue>());
+
+	m_Running = true;
+	for (uint32_t i = 0; i < count; i++)
+		m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, (size_t)i);
+}
+
+void ThreadPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Running = false;
+	}
+	m_WakeCondition.notify_all();
+
+	for (auto &worker : m_Workers)
+		worker.join();
+	m_Workers.clear();
+}
+
+void ThreadPool::WorkerLoop(const size_t &index)
+{
+	Utils::s_WorkerPool = this;
+	Utils::s_WorkerIndex = index;
+
+	Task task;
+	while (true)
+	{
+		if (PopLocal(index, task) || Steal(index, task))
+		{
+			m_Pending--;
+			Run(task);
+			task.Function = nullptr;
+			continue;
+		}
+
+		// Sleep until there is something to run, finish queued work before exiting
+		std::unique_lock<std::mutex> lock(m_SleepMutex);
+		m_WakeCondition.wait(lock, [this]() { return m_Pending > 0 || !m_Running; });
+		if (!m_Running && m_Pending == 0)
+			return;
+	}
+}
+
+void ThreadPool::Run(Task &task)
+{
+	if (!task.Parent)
+	{
+		task.Function();
+		return;
+	}
+
+	// The batch lives on the stack of the thread waiting for it, so it must not be touched once Done is set
+	Batch *batch = task.Parent;
+	(*batch->Job)(task.Index);
+	if (--batch->Remaining == 0)
+	{
+		std::lock_guard<std::mutex> lock(batch->Mutex);
+		batch->Done = true;
+		batch->Finished.notify_all();
+	}
+}
+
+void ThreadPool::Push(const size_t &queue, Task task)
+{
+	// Counted before it is queued, a thread that takes it straight away must not bring the count below zero.
+	// Taking the sleep lock makes sure a worker about to wait sees the new task.
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Pending++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Queues[queue]->Mutex);
+		m_Queues[queue]->Tasks.push_back(std::move(task));
+	}
+	m_WakeCondition.notify_one();
+}
+
+bool ThreadPool::PopLocal(const size_t &queue, Task &task, const void *batch)
+{
+	WorkQueue &owner = *m_Queues[queue];
+	std::lock_guard<std::mutex> lock(owner.Mutex);
+	auto &tasks = owner.Tasks;
+
+	// Take the newest task, or the newest one from the requested batch
+	size_t i = tasks.size();
+	while (i > owner.Head && batch && tasks[i - 1].Parent != batch)
+		i--;
+	if (i == owner.Head)
+		return false;
+
+	task = std::move(tasks[i - 1]);
+	tasks.erase(tasks.begin() + (i - 1));
+	if (owner.Head == tasks.size())
+	{
+		tasks.clear();
+		owner.Head = 0;
+	}
+	return true;
+}
+
+bool ThreadPool::Steal(const size_t &thief, Task &task, const void *batch)
+{
+	for (size_t i = 1; i < m_Queues.size(); i++)
+	{
+		WorkQueue &victim = *m_Queues[(thief + i) % m_Queues.size()];
+
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		auto &tasks = victim.Tasks;
+
+		// Take the oldest task, or the oldest one from the requested batch
+		size_t j = victim.Head;
+		while (j < tasks.size() && batch && tasks[j].Parent != batch)
+			j++;
+		if (j == tasks.size())
+			continue;
+
+		task = std::move(tasks[j]);
+		if (j == victim.Head)
+			victim.Head++;
+		else
+			tasks.erase(tasks.begin() + j);
+
+		if (victim.Head == tasks.size())
+		{
+			tasks.clear();
+			victim.Head = 0;
+		}
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads. Every worker owns a queue of tasks, it runs tasks from the back
+// of its own queue and steals from the front of the other queues once its own queue is empty.
+// The queues keep their storage between batches, so ParallelFor does not allocate once they have grown.
+class ThreadPool
+{
+public:
+	ThreadPool(const uint32_t &threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Pool shared by the noise generator and renderer
+	static ThreadPool &Get();
+
+	// Queues a task to run on a worker without waiting for it
+	void Submit(std::function<void()> task);
+
+	// Runs job(i) for every i in [0, count) and waits for all of them to finish.
+	// The calling thread helps run tasks while it waits, so this can be called from inside a task.
+	void ParallelFor(const size_t &count, const std::function<void(size_t)> &job);
+
+	// Like ParallelFor, but at most maxThreads threads run job at a time, each taking the next index until all are done.
+	// The workers are shared with everything else on the pool, so the cap only applies to this call (0 is no cap).
+	void ParallelFor(const size_t &count, const std::function<void(size_t)> &job, const uint32_t &maxThreads);
+
+	uint32_t GetThreadCount() const { return (uint32_t)m_Workers.size(); }
+
+private:
+	// The indices of a ParallelFor share one job instead of each wrapping it in a function
+	struct Batch
+	{
+		const std::function<void(size_t)> *Job = nullptr;
+		std::atomic<size_t> Remaining{ 0 };
+
+		// Set under Mutex by the thread that finishes the last index, so the waiting thread only frees the batch
+		// once nothing else touches it
+		std::mutex Mutex;
+		std::condition_variable Finished;
+		bool Done = false;
+	};
+
+	struct Task
+	{
+		std::function<void()> Function;
+		Batch *Parent = nullptr;
+		size_t Index = 0;
+	};
+
+	// Tasks are taken from the back by the owner and from Head by thieves, the vector is cleared once it is empty
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::vector<Task> Tasks;
+		size_t Head = 0;
+	};
+
+	void Start(const uint32_t &threadCount);
+	void Stop();
+	void WorkerLoop(const size_t &index);
+	void Run(Task &task);
+
+	// A batch other than nullptr restricts the search to that ParallelFor's tasks, so a thread waiting on
+	// its own batch never picks up an unrelated long running task
+	void Push(const size_t &queue, Task task);
+	bool PopLocal(const size_t &queue, Task &task, const void *batch = nullptr);
+	bool Steal(const size_t &thief, Task &task, const void *batch = nullptr);
+
+private:
+	std::vector<std::thread> m_Workers;
+	std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+
+	std::atomic<size_t> m_Pending{ 0 };
+	std::atomic<size_t> m_NextQueue{ 0 };
+	std::atomic<bool> m_Running{ false };
+
+	std::mutex m_SleepMutex;
+	std::condition_variable m_WakeCondition;
+};
@@ -7,6 +7,8 @@
 
 #include "Renderer.hpp"
 #include "Camera.hpp"
+#include "SceneFile.hpp"
+#include "HeightmapExporter.hpp"
 
 #include <memory>
 #include <glm/gtc/type_ptr.hpp>
@@ -25,15 +27,45 @@ public:
 	virtual void OnUpdate(float ts) override
 	{
 		if (m_Camera.OnUpdate(ts));
+		m_FrameTime = ts;
 	}
 	virtual void OnUIRender() override
 	{
 		ImGui::Begin("Settings");
 		ImGui::Text("Last render: %.3fms", m_LastRenderTime);
+#ifdef PN_COUNT_ALLOCATIONS
+		ImGui::Text("Last render allocations: %llu", (unsigned long long)m_Renderer.GetFrameAllocations());
+#endif
 
 		ImGui::Checkbox("Parallel Rendering", &m_Renderer.GetSettings().Parallel);
 		ImGui::Checkbox("Render Noise Map", &m_Renderer.GetSettings().Noise);
 		ImGui::Checkbox("Octree Optimization (Recommended)", &m_Renderer.GetSettings().OcTree);
+		ImGui::Checkbox("Heightfield Ray Marching", &m_Renderer.GetSettings().HeightField);
+		ImGui::Checkbox("Packet Tracing", &m_Renderer.GetSettings().Packets);
+		ImGui::Checkbox("Skip Unchanged Frames", &m_Renderer.GetSettings().Cache);
+		ImGui::Checkbox("Progressive Rendering", &m_Renderer.GetSettings().Progressive);
+		ImGui::Checkbox("Log Scene Builds", &m_Renderer.GetSettings().Verbose);
+
+		bool cacheRays = m_Camera.GetCacheRayDirections();
+		if (ImGui::Checkbox("Cache Ray Directions", &cacheRays))
+			m_Camera.SetCacheRayDirections(cacheRays);
+
+		ImGui::PushItemWidth(120);
+		int threads = (int)m_Renderer.GetSettings().Threads;
+		if (ImGui::InputInt("Render Threads (0 = All)", &threads))
+			m_Renderer.GetSettings().Threads = (uint32_t)std::clamp(threads, 0, 256);
+
+		int tileSize = (int)m_Renderer.GetSettings().TileSize;
+		if (ImGui::InputInt("Tile Size", &tileSize, 8, 8))
+			m_Renderer.GetSettings().TileSize = (uint32_t)std::clamp(tileSize, 8, 128);
+
+		if (m_Renderer.GetSettings().Progressive)
+		{
+			float target = m_Renderer.GetSettings().TargetFrameTime;
+			if (ImGui::InputFloat("Target Frame Time (ms)", &target, 1.0f, 5.0f, "%.1f"))
+				m_Renderer.GetSettings().TargetFrameTime = std::clamp(target, 1.0f, 100.0f);
+		}
+		ImGui::PopItemWidth();
 		if (ImGui::Checkbox("Color Height Map", &m_Scene.GetNoiseSettings()->Color));
 
 		float speed = m_Camera.GetSpeed();
@@ -87,6 +119,89 @@ public:
 		}
 		ImGui::PopItemWidth();
 
+		// Infinite terrain streamed in chunks around the camera
+		if (ImGui::Checkbox("Stream Terrain", &m_Scene.Streaming) && !m_Scene.Streaming)
+			m_Scene.StopStreaming();
+
+		// The generated map evolving over time, regenerated every frame
+		if (ImGui::Checkbox("Animate Terrain", &m_Scene.Animated) && !m_Scene.Animated)
+			m_Scene.PerlinNoiseGenerator.StopAnimation();
+
+		if (m_Scene.Animated)
+		{
+			ImGui::PushItemWidth(120);
+			if (ImGui::InputFloat("Animation Speed", &m_Scene.AnimationSpeed, 0.0f, 0.0f, "%.3f"))
+				m_Scene.AnimationSpeed = std::clamp(m_Scene.AnimationSpeed, 0.0f, 16.0f);
+
+			float loop = (float)m_Scene.PerlinNoiseGenerator.GetAnimationLoop();
+			if (ImGui::InputFloat("Loop Length (0 = Off)", &loop, 0.0f, 0.0f, "%.2f"))
+				m_Scene.PerlinNoiseGenerator.SetAnimationLoop(loop);
+			ImGui::PopItemWidth();
+		}
+
+		if (m_Scene.Streaming)
+		{
+			ImGui::PushItemWidth(120);
+			int viewDistance = m_Scene.Chunks.GetViewDistance();
+			if (ImGui::InputInt("View Distance (chunks)", &viewDistance))
+				m_Scene.Chunks.SetViewDistance(std::clamp(viewDistance, 1, 8));
+
+			int budget = (int)(m_Scene.Chunks.GetMemoryBudget() / (1024 * 1024));
+			if (ImGui::InputInt("Chunk Cache (MB)", &budget))
+				m_Scene.Chunks.SetMemoryBudget((size_t)std::clamp(budget, 1, 4096) * 1024 * 1024);
+			ImGui::PopItemWidth();
+
+			ImGui::Text("Chunks: %zu cached, %zu pending, %.1fMB", m_Scene.Chunks.GetChunkCount(),
+				m_Scene.Chunks.GetPendingCount(), m_Scene.Chunks.GetMemoryUsage() / (1024.0 * 1024.0));
+		}
+
+		// Loading a saved scene maps it in instead of generating the noise and building the OcTree again
+		ImGui::PushItemWidth(200);
+		ImGui::InputText("Scene File", m_ScenePath, sizeof(m_ScenePath));
+		ImGui::PopItemWidth();
+		if (ImGui::Button("Save Scene"))
+			m_SceneFileStatus = SceneFile::Write(m_ScenePath, m_Scene) ? "Saved" : "Failed to save";
+		ImGui::SameLine();
+		if (ImGui::Button("Load Scene"))
+			m_SceneFileStatus = SceneFile::Load(m_ScenePath, m_Scene) ? "Loaded" : "Failed to load";
+		if (m_SceneFileStatus)
+			ImGui::Text("%s", m_SceneFileStatus);
+
+		// Bakes the map at any size straight to disk in the background, without holding all of it in memory
+		ImGui::PushItemWidth(200);
+		ImGui::InputText("Export File (.png/.raw)", m_ExportPath, sizeof(m_ExportPath));
+		ImGui::PopItemWidth();
+		ImGui::PushItemWidth(120);
+		if (ImGui::InputInt("Export Size", &m_ExportSize, 1024, 1024))
+			m_ExportSize = std::clamp(m_ExportSize, 1, 65536);
+		if (ImGui::InputInt("Export Tile Size (0 = Off)", &m_ExportTileSize, 256, 256))
+			m_ExportTileSize = std::clamp(m_ExportTileSize, 0, 65536);
+		ImGui::PopItemWidth();
+
+		if (m_Exporter.IsExporting())
+		{
+			ImGui::ProgressBar(m_Exporter.GetProgress());
+		}
+		else
+		{
+			if (m_ExportStarted)
+				m_ExportStatus = m_Exporter.Wait() ? "Exported" : "Failed to export";
+			m_ExportStarted = false;
+
+			if (ImGui::Button("Export Heightmap"))
+			{
+				HeightmapExporter::Settings settings;
+				settings.FileFormat = HeightmapExporter::GetFormat(m_ExportPath);
+				settings.Width = settings.Height = (uint32_t)m_ExportSize;
+				settings.TileSize = (uint32_t)m_ExportTileSize;
+				m_Exporter.ExportAsync(m_ExportPath, m_Scene.PerlinNoiseGenerator, settings);
+				m_ExportStarted = true;
+				m_ExportStatus = nullptr;
+			}
+			if (m_ExportStatus)
+				ImGui::Text("%s", m_ExportStatus);
+		}
+
 		ImGui::End();
 
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
@@ -112,9 +227,22 @@ public:
 
 		m_Renderer.OnResize(m_ViewportWidth, m_ViewportHeight);
 		m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
-		m_Renderer.Render(m_Scene, m_Camera);
 
-		m_LastRenderTime = timer.ElapsedMillis();
+		// Take the new noise if it was generated, or new chunks if they arrived while streaming
+		bool generated = m_Scene.GUI();
+		if (m_Scene.Streaming)
+			m_Scene.Stream(m_Camera.GetPosition());
+		else if (m_Scene.Animated)
+			m_Scene.Animate(m_FrameTime);
+		else if (generated)
+			m_Scene.UseGeneratedNoise();
+
+		// Only rebuilds the stages after the noise or height scale changed
+		m_Renderer.UpdateScene(m_Scene);
+
+		// Only time frames that were traced, idle frames reuse the last image
+		if (m_Renderer.Render(m_Scene, m_Camera))
+			m_LastRenderTime = timer.ElapsedMillis();
 	}
 
 private:
@@ -124,6 +252,17 @@ private:
 
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 	float m_LastRenderTime = 0.0f;
+	float m_FrameTime = 0.0f;
+
+	char m_ScenePath[256] = "scene.pnscene";
+	const char *m_SceneFileStatus = nullptr;
+
+	HeightmapExporter m_Exporter;
+	char m_ExportPath[256] = "heightmap.png";
+	int m_ExportSize = 8192;
+	int m_ExportTileSize = 0;
+	bool m_ExportStarted = false;
+	const char *m_ExportStatus = nullptr;
 };
  
 
@@ -0,0 +1,72 @@
+project "PerlinNoiseBenchmark"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   staticruntime "off"
+
+   -- Benchmarks the same sources as the headless app against Google Benchmark
+   files
+   {
+      "src/**.h",
+      "src/**.hpp",
+      "src/**.cpp",
+
+      "../PerlinNoise/src/**.hpp",
+      "../PerlinNoise/src/**.cpp",
+   }
+
+   removefiles
+   {
+      "../PerlinNoise/src/WalnutApp.cpp",
+   }
+
+   includedirs
+   {
+      "../Walnut/vendor/glm",
+
+      "../PerlinNoise/src",
+   }
+
+   -- Replaces operator new so traced frames can report their heap allocations
+   defines
+   {
+      "PN_HEADLESS",
+      "PN_COUNT_ALLOCATIONS"
+   }
+
+   links
+   {
+      "benchmark"
+   }
+
+   -- Google Benchmark is not vendored, point BENCHMARK_DIR at an install if it is not on the system paths
+   local benchmarkDir = os.getenv("BENCHMARK_DIR")
+   if benchmarkDir then
+      includedirs { benchmarkDir .. "/include" }
+      libdirs { benchmarkDir .. "/lib" }
+   end
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+      defines { "BENCHMARK_STATIC_DEFINE" }
+      links { "Shlwapi" }
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
@@ -0,0 +1,374 @@
+#include "Renderer.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "SceneFile.hpp"
+#include "HeightmapExporter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <initializer_list>
+#include <vector>
+
+// Microbenchmarks for noise generation, OcTree construction and ray casting
+// Run with --benchmark_out=results.json --benchmark_out_format=json to get a diffable report
+
+namespace Utils
+{
+	constexpr int    NoiseSeed        = 1337;
+	constexpr int    NoiseCellSize    = 16;
+	constexpr double NoiseAttenuation = 0.5;
+	constexpr int    NoiseHeightScale = 32;
+
+	constexpr uint32_t ViewportWidth  = 128;
+	constexpr uint32_t ViewportHeight = 72;
+
+	// How BM_CastRays intersects the scene
+	enum CastMode
+	{
+		CastBruteForce  = 0,
+		CastOcTree      = 1,
+		CastHeightField = 2,
+		CastOcTreeRays  = 3, // OcTree one ray at a time instead of in packets
+	};
+
+	// Time per sample, the inverse of the samples processed per second
+	static benchmark::Counter PerSample(const double &samples)
+	{
+		return benchmark::Counter(samples, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+	}
+
+	static benchmark::Counter PerSecond(const double &count)
+	{
+		return benchmark::Counter(count, benchmark::Counter::kIsIterationInvariantRate);
+	}
+
+	// Grid sizes from 32^2 to 4096^2 with 1 to 8 octaves
+	static void NoiseArguments(benchmark::internal::Benchmark *benchmark)
+	{
+		benchmark->ArgNames({ "size", "levels" });
+		for (int size = 32; size <= 4096; size *= 2)
+		{
+			for (int levels : { 1, 2, 4, 8 })
+				benchmark->Args({ size, levels });
+		}
+	}
+
+	static void GenerateScene(Scene &scene, Renderer &renderer, const int &size)
+	{
+		scene.SetNoiseHeight(NoiseHeightScale);
+		scene.PerlinNoiseGenerator.Generate(NoiseSeed, size, size, NoiseCellSize, 4, NoiseAttenuation);
+		scene.UseGeneratedNoise();
+		renderer.UpdateScene(scene);
+	}
+
+	// Fixed camera poses so ray casting numbers are comparable across runs
+	static void SetCameraPose(Camera &camera, const int &pose, const int &size)
+	{
+		float sizef = (float)size;
+		float heightf = (float)NoiseHeightScale;
+
+		switch (pose)
+		{
+		// Looking across the map from one of its corners
+		case 0: camera.SetPose(glm::vec3(-0.25f * sizef, 1.5f * heightf, -0.25f * sizef), glm::vec3(1.0f, -0.5f, 1.0f)); break;
+		// Looking straight down at the center of the map
+		case 1: camera.SetPose(glm::vec3(0.5f * sizef, 2.0f * sizef, 0.5f * sizef), glm::vec3(0.01f, -1.0f, 0.01f)); break;
+		// Skimming the terrain towards the horizon
+		default: camera.SetPose(glm::vec3(-8.0f, 0.75f * heightf, 0.5f * sizef), glm::vec3(1.0f, -0.1f, 0.0f)); break;
+		}
+	}
+}
+
+static void BM_Noise2D(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int levels = (int)state.range(1);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+
+	for (auto _ : state)
+	{
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+				benchmark::DoNotOptimize(generator.Noise2D((double)x / Utils::NoiseCellSize, (double)y / Utils::NoiseCellSize));
+		}
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_Noise2D)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_Noise2DRow(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int levels = (int)state.range(1);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+
+	std::vector<double> x(size);
+	std::vector<double> row(size);
+	for (int i = 0; i < size; i++)
+		x[i] = (double)i / Utils::NoiseCellSize;
+
+	for (auto _ : state)
+	{
+		for (int y = 0; y < size; y++)
+			generator.Noise2DRow(x.data(), (double)y / Utils::NoiseCellSize, row.data(), row.size());
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_Noise2DRow)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_OctaveNoise2D(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int levels = (int)state.range(1);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+
+	for (auto _ : state)
+	{
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+				benchmark::DoNotOptimize(generator.OctaveNoise2D(x, y));
+		}
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_OctaveNoise2D)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_OctaveNoise2DRow(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int levels = (int)state.range(1);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+
+	std::vector<double> row(size);
+
+	for (auto _ : state)
+	{
+		for (int y = 0; y < size; y++)
+			generator.OctaveNoise2DRow(0, y, row.data(), row.size());
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_OctaveNoise2DRow)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+
+// Octaves looped over at run time, the baseline for the level specialised kernels BM_OctaveNoise2DRow uses
+static void BM_OctaveNoise2DRowGeneric(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int levels = (int)state.range(1);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+
+	std::vector<double> row(size);
+
+	for (auto _ : state)
+	{
+		for (int y = 0; y < size; y++)
+			generator.OctaveNoise2DRowGeneric(0, y, row.data(), row.size());
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_OctaveNoise2DRowGeneric)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+
+// Heights stored as double, float or quantised to 16 bits
+template<typename T>
+static void BM_SampleRegion(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int levels = (int)state.range(1);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, levels, Utils::NoiseAttenuation);
+
+	std::vector<T> heights((size_t)size * size);
+
+	for (auto _ : state)
+	{
+		generator.SampleRegion(0, 0, size, size, heights.data(), size);
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+	state.counters["bytes"] = (double)(heights.size() * sizeof(T));
+}
+BENCHMARK_TEMPLATE(BM_SampleRegion, double)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SampleRegion, float)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SampleRegion, uint16_t)->Apply(Utils::NoiseArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_OcTreeGenerate(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+
+	Scene scene;
+	scene.PerlinNoiseGenerator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, 4, Utils::NoiseAttenuation);
+	scene.UseGeneratedNoise();
+
+	std::vector<glm::vec3> points;
+	scene.GeneratePoints(points, Utils::NoiseHeightScale);
+	uint32_t dimension = (uint32_t)std::max(size, Utils::NoiseHeightScale);
+
+	for (auto _ : state)
+	{
+		OcTree ocTree;
+		ocTree.Generate(dimension, points);
+		benchmark::DoNotOptimize(ocTree.GetPointCount());
+	}
+
+	state.counters["points/s"] = Utils::PerSecond((double)points.size());
+}
+BENCHMARK(BM_OcTreeGenerate)->ArgName("size")->RangeMultiplier(2)->Range(32, 2048)->Unit(benchmark::kMillisecond);
+
+// Converting a map to the GUI preview's pixels, color 0 is grayscale and 1 is the terrain colors
+static void BM_ConvertToRGBA(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, 4, Utils::NoiseAttenuation);
+	generator.Generate(Utils::NoiseSeed, size, size, Utils::NoiseCellSize, 4, Utils::NoiseAttenuation);
+
+	NoiseSettings settings;
+	settings.Color = state.range(1) != 0;
+	ShadingPalette palette;
+	PerlinNoiseGenerator::BuildPreviewPalette(settings, palette);
+	std::vector<uint32_t> pixels((size_t)size * size);
+
+	for (auto _ : state)
+	{
+		PerlinNoiseGenerator::ConvertToRGBA(generator.GetNoise().data(), pixels.size(), palette, pixels.data());
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_ConvertToRGBA)->ArgNames({ "size", "color" })->ArgsProduct({ { 512, 2048 }, { 0, 1 } })->Unit(benchmark::kMicrosecond);
+
+// Loading the scene from a file instead of generating the noise and building it, comparable to BM_OcTreeGenerate
+static void BM_SceneFileLoad(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	const char *path = "BM_SceneFileLoad.pnscene";
+
+	Scene scene;
+	Renderer renderer;
+	Utils::GenerateScene(scene, renderer, size);
+	if (!SceneFile::Write(path, scene))
+	{
+		state.SkipWithError("Failed to write the scene file");
+		return;
+	}
+
+	for (auto _ : state)
+	{
+		Scene loaded;
+		benchmark::DoNotOptimize(SceneFile::Load(path, loaded));
+	}
+
+	std::remove(path);
+	state.counters["points/s"] = Utils::PerSecond((double)scene.ocTree->GetPointCount());
+}
+BENCHMARK(BM_SceneFileLoad)->ArgName("size")->RangeMultiplier(2)->Range(32, 2048)->Unit(benchmark::kMillisecond);
+
+// Baking a map to disk with generation overlapped with writing, format 0 is PNG16 and 1 is Raw
+static void BM_HeightmapExport(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	bool png = state.range(1) == 0;
+	const char *path = png ? "BM_HeightmapExport.png" : "BM_HeightmapExport.raw";
+
+	PerlinNoiseGenerator generator(Utils::NoiseSeed, 1, 1, Utils::NoiseCellSize, 4, Utils::NoiseAttenuation);
+	HeightmapExporter exporter;
+	HeightmapExporter::Settings settings;
+	settings.FileFormat = png ? HeightmapExporter::Format::PNG16 : HeightmapExporter::Format::Raw;
+	settings.Width = settings.Height = (uint32_t)size;
+
+	for (auto _ : state)
+	{
+		if (!exporter.Export(path, generator, settings))
+		{
+			state.SkipWithError("Failed to export the heightmap");
+			break;
+		}
+	}
+
+	std::remove(path);
+	state.counters["time/sample"] = Utils::PerSample((double)size * size);
+}
+BENCHMARK(BM_HeightmapExport)->ArgNames({ "size", "format" })->ArgsProduct({ { 1024, 4096 }, { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+static void BM_RayDirections(benchmark::State &state)
+{
+	uint32_t width = (uint32_t)state.range(0);
+	uint32_t height = (uint32_t)state.range(1);
+
+	Camera camera(45.0f, 0.1f, 100.0f);
+	camera.OnResize(width, height);
+
+	// Alternate between two poses so every iteration recalculates the directions
+	glm::vec3 direction = glm::vec3(1.0f, -0.5f, 1.0f);
+	int frame = 0;
+	for (auto _ : state)
+	{
+		camera.SetPose(glm::vec3((float)(frame++ & 1)), direction);
+		benchmark::DoNotOptimize(camera.GetRayDirections().data());
+	}
+
+	state.counters["rays/s"] = Utils::PerSecond((double)width * height);
+}
+BENCHMARK(BM_RayDirections)->ArgNames({ "width", "height" })->Args({ 1280, 720 })->Args({ 1920, 1080 })->Args({ 3840, 2160 })->Unit(benchmark::kMillisecond);
+
+static void BM_CastRays(benchmark::State &state)
+{
+	int size = (int)state.range(0);
+	int pose = (int)state.range(1);
+	int mode = (int)state.range(2);
+
+	Scene scene;
+	Renderer renderer;
+	Camera camera(45.0f, 0.1f, 100.0f);
+	Utils::GenerateScene(scene, renderer, size);
+
+	renderer.GetSettings().Noise = true;
+	renderer.GetSettings().OcTree = mode == Utils::CastOcTree || mode == Utils::CastOcTreeRays;
+	renderer.GetSettings().Packets = mode != Utils::CastOcTreeRays;
+	renderer.GetSettings().HeightField = mode == Utils::CastHeightField;
+	renderer.GetSettings().Parallel = false;
+	renderer.GetSettings().Cache = false;
+
+	renderer.OnResize(Utils::ViewportWidth, Utils::ViewportHeight);
+	camera.OnResize(Utils::ViewportWidth, Utils::ViewportHeight);
+	Utils::SetCameraPose(camera, pose, size);
+
+	for (auto _ : state)
+	{
+		renderer.Render(scene, camera);
+		benchmark::ClobberMemory();
+	}
+
+	state.counters["rays/s"] = Utils::PerSecond((double)Utils::ViewportWidth * Utils::ViewportHeight);
+}
+// Brute force tests every voxel per ray, so it is only run on small maps
+BENCHMARK(BM_CastRays)->ArgNames({ "size", "pose", "mode" })
+	->ArgsProduct({ { 32, 128, 512 }, { 0, 1, 2 }, { Utils::CastOcTree, Utils::CastOcTreeRays, Utils::CastHeightField } })
+	->ArgsProduct({ { 32, 64 }, { 0, 1, 2 }, { Utils::CastBruteForce } })
+	->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,59 @@
+project "PerlinNoiseHeadless"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   targetdir "bin/%{cfg.buildcfg}"
+   staticruntime "off"
+
+   -- Share the noise, octree, camera and renderer code with the GUI app, minus the Walnut entry point
+   files
+   {
+      "src/**.h",
+      "src/**.hpp",
+      "src/**.cpp",
+
+      "../PerlinNoise/src/**.hpp",
+      "../PerlinNoise/src/**.cpp",
+   }
+
+   removefiles
+   {
+      "../PerlinNoise/src/WalnutApp.cpp",
+   }
+
+   includedirs
+   {
+      "../Walnut/vendor/glm",
+
+      "../PerlinNoise/src",
+   }
+
+   -- Replaces operator new so traced frames can report their heap allocations
+   defines
+   {
+      "PN_HEADLESS",
+      "PN_COUNT_ALLOCATIONS"
+   }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
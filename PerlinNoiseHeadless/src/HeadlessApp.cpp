@@ -0,0 +1,429 @@
+#include "Renderer.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "SceneFile.hpp"
+#include "HeightmapExporter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+
+// Renders the noise scene without Walnut/Vulkan so it can be timed on machines without a GPU
+
+namespace Utils
+{
+	struct HeadlessOptions
+	{
+		int    Seed        = 0;
+		int    Width       = 256;
+		int    Height      = 256;
+		int    CellSize    = 16;
+		int    Levels      = 2;
+		double Attenuation = 0.15;
+		int    HeightScale = 32;
+
+		uint32_t ViewportWidth  = 1280;
+		uint32_t ViewportHeight = 720;
+		int      Frames         = 10;
+
+		bool      CustomPose        = false;
+		glm::vec3 CameraPosition    { 0.0f };
+		glm::vec3 CameraDirection   { 1.0f, -0.5f, 1.0f };
+		glm::vec3 CameraMove        { 0.0f };
+
+		bool        OcTree      = true;
+		bool        HeightField = false;
+		bool        Packets     = true;
+		bool        Parallel    = true;
+		bool        Progressive = false;
+		float       TargetFrameTime = 16.0f;
+		bool        CacheRays   = true;
+		bool        Verbose     = false;
+		uint32_t    Threads     = 0;
+		uint32_t    TileSize    = 32;
+		int         Stream   = 0;
+		double      Animate  = 0.0;
+		double      Loop     = 0.0;
+		std::string Load     = "";
+		std::string Save     = "";
+		std::string Export   = "";
+		uint32_t    ExportTile = 0;
+		std::string Output   = "";
+	};
+
+	class Stopwatch
+	{
+	public:
+		Stopwatch() { Reset(); }
+
+		void Reset() { m_Start = std::chrono::high_resolution_clock::now(); }
+
+		double ElapsedMillis() const
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_Start).count();
+		}
+
+	private:
+		std::chrono::time_point<std::chrono::high_resolution_clock> m_Start;
+	};
+
+	static void PrintUsage()
+	{
+		std::cout << "Usage: PerlinNoiseHeadless [options]\n"
+			<< "  --seed <int>                 Noise seed (default 0)\n"
+			<< "  --size <int>                 Sets both the noise width and height\n"
+			<< "  --width <int>                Noise width (default 256)\n"
+			<< "  --height <int>               Noise height (default 256)\n"
+			<< "  --cellsize <int>             Noise cell size (default 16)\n"
+			<< "  --levels <int>               Noise octaves (default 2)\n"
+			<< "  --attenuation <float>        Amplitude falloff per octave (default 0.15)\n"
+			<< "  --height-scale <int>         Voxel height of the terrain (default 32)\n"
+			<< "  --viewport <w>x<h>           Render resolution (default 1280x720)\n"
+			<< "  --camera <x>,<y>,<z>         Camera position\n"
+			<< "  --direction <x>,<y>,<z>      Camera forward direction\n"
+			<< "  --frames <int>               Number of frames to render (default 10)\n"
+			<< "  --move <x>,<y>,<z>           Move the camera by this much before every frame after the first\n"
+			<< "  --no-octree                  Brute force every voxel instead of using the OcTree\n"
+			<< "  --heightfield                March the heightfield's min/max mips instead of using the OcTree\n"
+			<< "  --no-packets                 Walk the OcTree one ray at a time instead of in 2x2 packets\n"
+			<< "  --serial                     Disable parallel rendering\n"
+			<< "  --progressive                Trace the first frame at a lower resolution and refine it over the next ones\n"
+			<< "  --target-ms <float>          Frame time progressive rendering aims for while moving (default 16)\n"
+			<< "  --no-ray-cache               Derive each ray direction from the camera's basis instead of caching one per pixel\n"
+			<< "  --verbose                    Print the scene's size and memory use whenever it is rebuilt\n"
+			<< "  --threads <int>              Most render threads, 0 uses every hardware thread (default 0)\n"
+			<< "  --tile-size <int>            Width and height of the tiles rendered in parallel (default 32)\n"
+			<< "  --stream <chunks>            Stream chunks around the camera with this view distance instead of a fixed map\n"
+			<< "  --animate <cells/s>          Regenerate the map at 60 frames per second of animation time before every frame\n"
+			<< "  --loop <cells>               Loop the animation after moving this far through time (default 0, no loop)\n"
+			<< "  --load <file>                Trace a scene file instead of generating the noise and building the scene\n"
+			<< "  --save <file>                Write the scene to a file that --load can map straight back in\n"
+			<< "  --export <file>              Bake the map to a 16-bit .png or .raw in strips instead of rendering it\n"
+			<< "  --export-tile <int>          Split the export into files of this many heights square (default 0, one file)\n"
+			<< "  --output <file.ppm>          Write the final frame as a binary PPM\n";
+	}
+
+	static bool ParseVec3(const char *text, glm::vec3 &out)
+	{
+		return std::sscanf(text, "%f,%f,%f", &out.x, &out.y, &out.z) == 3;
+	}
+
+	static bool ParseOptions(int argc, char **argv, HeadlessOptions &options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+			// Flags without a value
+			if (arg == "--no-octree") { options.OcTree = false; continue; }
+			if (arg == "--heightfield") { options.HeightField = true; continue; }
+			if (arg == "--no-packets") { options.Packets = false; continue; }
+			if (arg == "--serial") { options.Parallel = false; continue; }
+			if (arg == "--progressive") { options.Progressive = true; continue; }
+			if (arg == "--no-ray-cache") { options.CacheRays = false; continue; }
+			if (arg == "--verbose") { options.Verbose = true; continue; }
+			if (arg == "--help" || arg == "-h") return false;
+
+			if (!value)
+			{
+				std::cerr << "Missing value for " << arg << '\n';
+				return false;
+			}
+			i++;
+
+			if (arg == "--seed") options.Seed = std::atoi(value);
+			else if (arg == "--size") options.Width = options.Height = std::atoi(value);
+			else if (arg == "--width") options.Width = std::atoi(value);
+			else if (arg == "--height") options.Height = std::atoi(value);
+			else if (arg == "--cellsize") options.CellSize = std::atoi(value);
+			else if (arg == "--levels") options.Levels = std::atoi(value);
+			else if (arg == "--attenuation") options.Attenuation = std::atof(value);
+			else if (arg == "--height-scale") options.HeightScale = std::atoi(value);
+			else if (arg == "--frames") options.Frames = std::atoi(value);
+			else if (arg == "--threads") options.Threads = (uint32_t)std::max(std::atoi(value), 0);
+			else if (arg == "--target-ms") options.TargetFrameTime = (float)std::atof(value);
+			else if (arg == "--tile-size") options.TileSize = (uint32_t)std::max(std::atoi(value), 1);
+			else if (arg == "--stream") options.Stream = std::max(std::atoi(value), 1);
+			else if (arg == "--animate") options.Animate = std::max(std::atof(value), 0.0);
+			else if (arg == "--loop") options.Loop = std::max(std::atof(value), 0.0);
+			else if (arg == "--load") options.Load = value;
+			else if (arg == "--save") options.Save = value;
+			else if (arg == "--export") options.Export = value;
+			else if (arg == "--export-tile") options.ExportTile = (uint32_t)std::max(std::atoi(value), 0);
+			else if (arg == "--output") options.Output = value;
+			else if (arg == "--viewport")
+			{
+				if (std::sscanf(value, "%ux%u", &options.ViewportWidth, &options.ViewportHeight) != 2)
+				{
+					std::cerr << "Invalid viewport " << value << '\n';
+					return false;
+				}
+			}
+			else if (arg == "--camera")
+			{
+				if (!ParseVec3(value, options.CameraPosition))
+				{
+					std::cerr << "Invalid camera position " << value << '\n';
+					return false;
+				}
+				options.CustomPose = true;
+			}
+			else if (arg == "--direction")
+			{
+				if (!ParseVec3(value, options.CameraDirection))
+				{
+					std::cerr << "Invalid camera direction " << value << '\n';
+					return false;
+				}
+			}
+			else if (arg == "--move")
+			{
+				if (!ParseVec3(value, options.CameraMove))
+				{
+					std::cerr << "Invalid camera move " << value << '\n';
+					return false;
+				}
+			}
+			else
+			{
+				std::cerr << "Unknown option " << arg << '\n';
+				return false;
+			}
+		}
+
+		// Loaded scenes are fixed maps
+		if (!options.Load.empty() && (options.Stream || options.Animate > 0.0))
+		{
+			std::cerr << "--load cannot be combined with --stream or --animate\n";
+			return false;
+		}
+
+		// Clamp the values the same way the GUI does
+		options.Width = std::max(options.Width, 1);
+		options.Height = std::max(options.Height, 1);
+		options.CellSize = std::clamp(options.CellSize, 1, std::min(options.Width, options.Height));
+		options.Levels = std::clamp(options.Levels, 1, 8);
+		options.Attenuation = std::max(options.Attenuation, std::numeric_limits<double>::min());
+		options.HeightScale = std::max(options.HeightScale, 1);
+		options.ViewportWidth = std::max(options.ViewportWidth, 1u);
+		options.ViewportHeight = std::max(options.ViewportHeight, 1u);
+		options.Frames = std::max(options.Frames, 1);
+
+		return true;
+	}
+
+	// Writes a 0xAABBGGRR color buffer as a binary PPM, flipped to match the viewport's orientation
+	static bool WritePPM(const std::string &path, const uint32_t *pixels, size_t width, size_t height)
+	{
+		FILE *file = std::fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		std::fprintf(file, "P6\n%zu %zu\n255\n", width, height);
+
+		std::string row(width * 3, '\0');
+		for (size_t y = height; y-- > 0;)
+		{
+			for (size_t x = 0; x < width; x++)
+			{
+				uint32_t color = pixels[x + y * width];
+				row[x * 3 + 0] = (char)(color & 0xff);
+				row[x * 3 + 1] = (char)((color >> 8) & 0xff);
+				row[x * 3 + 2] = (char)((color >> 16) & 0xff);
+			}
+			std::fwrite(row.data(), 1, row.size(), file);
+		}
+
+		return std::fclose(file) == 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Utils::HeadlessOptions options;
+	if (!Utils::ParseOptions(argc, argv, options))
+	{
+		Utils::PrintUsage();
+		return 1;
+	}
+
+	// Baking never holds the whole map, so it can be far larger than anything that could be rendered
+	if (!options.Export.empty())
+	{
+		PerlinNoiseGenerator generator(options.Seed, 1, 1, options.CellSize, options.Levels, options.Attenuation);
+
+		HeightmapExporter::Settings settings;
+		settings.FileFormat = HeightmapExporter::GetFormat(options.Export);
+		settings.Width = (uint32_t)options.Width;
+		settings.Height = (uint32_t)options.Height;
+		settings.TileSize = options.ExportTile;
+
+		Utils::Stopwatch timer;
+		HeightmapExporter exporter;
+		if (!exporter.Export(options.Export, generator, settings))
+		{
+			std::cerr << "Failed to export " << options.Export << '\n';
+			return 1;
+		}
+		double exportTime = timer.ElapsedMillis();
+
+		std::printf("export_ms       %.3f\n", exportTime);
+		std::printf("samples_per_s   %.0f\n", (double)options.Width * options.Height / (exportTime / 1000.0));
+		std::printf("queue_kb        %zu\n", exporter.GetQueueMemory() / 1024);
+		return 0;
+	}
+
+	Scene scene;
+	Renderer renderer;
+	Camera camera(45.0f, 0.1f, 100.0f);
+
+	renderer.GetSettings().Noise = true;
+	renderer.GetSettings().OcTree = options.OcTree;
+	renderer.GetSettings().HeightField = options.HeightField;
+	renderer.GetSettings().Packets = options.Packets;
+	renderer.GetSettings().Cache = false; // Trace every frame so they can be timed
+	renderer.GetSettings().Parallel = options.Parallel;
+	renderer.GetSettings().Threads = options.Threads;
+	renderer.GetSettings().TileSize = options.TileSize;
+	renderer.GetSettings().Progressive = options.Progressive;
+	renderer.GetSettings().Verbose = options.Verbose;
+	renderer.GetSettings().TargetFrameTime = options.TargetFrameTime;
+
+	// A loaded scene brings its own map size and height scale
+	Utils::Stopwatch timer;
+	if (!options.Load.empty())
+	{
+		if (!SceneFile::Load(options.Load, scene))
+		{
+			std::cerr << "Failed to load " << options.Load << '\n';
+			return 1;
+		}
+		options.Width = (int)scene.NoiseWidth;
+		options.Height = (int)scene.NoiseHeight;
+		options.HeightScale = scene.GetNoiseHeight();
+	}
+	double loadTime = timer.ElapsedMillis();
+
+	// Default to looking across the map from one of its corners
+	if (!options.CustomPose)
+		options.CameraPosition = glm::vec3(-0.25f * options.Width, 1.5f * options.HeightScale, -0.25f * options.Height);
+
+	renderer.OnResize(options.ViewportWidth, options.ViewportHeight);
+	camera.SetCacheRayDirections(options.CacheRays);
+	camera.OnResize(options.ViewportWidth, options.ViewportHeight);
+	camera.SetPose(options.CameraPosition, options.CameraDirection);
+
+	// Noise generation, a loaded scene came with its noise
+	timer.Reset();
+	if (options.Load.empty())
+	{
+		scene.SetNoiseHeight(options.HeightScale);
+		scene.PerlinNoiseGenerator.Generate(options.Seed, options.Width, options.Height, options.CellSize, options.Levels, options.Attenuation);
+		if (options.Stream)
+		{
+			// Wait until every chunk in view has been generated and the window has been built from them
+			scene.Streaming = true;
+			scene.Chunks.SetViewDistance(options.Stream);
+			while (scene.Stream(camera.GetPosition()) || scene.Chunks.GetPendingCount() > 0 || scene.IsStreamBuilding())
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		else
+		{
+			scene.UseGeneratedNoise();
+		}
+	}
+	double noiseTime = timer.ElapsedMillis();
+
+	// Point generation and OcTree construction, nothing is built for a loaded scene
+	timer.Reset();
+	renderer.UpdateScene(scene);
+	double sceneTime = timer.ElapsedMillis();
+
+	timer.Reset();
+	if (!options.Save.empty() && !SceneFile::Write(options.Save, scene))
+	{
+		std::cerr << "Failed to write " << options.Save << '\n';
+		return 1;
+	}
+	double saveTime = timer.ElapsedMillis();
+
+	// Rendering
+	double renderTotal = 0.0;
+	double renderMin = std::numeric_limits<double>::max();
+	double renderMax = 0.0;
+	uint64_t renderAllocations = 0;
+	double animateNoiseTotal = 0.0;
+	double animateSceneTotal = 0.0;
+	scene.PerlinNoiseGenerator.SetAnimationLoop(options.Loop);
+	for (int frame = 0; frame < options.Frames; frame++)
+	{
+		// Animation regenerates the map and rebuilds the scene from it before every frame
+		if (options.Animate > 0.0 && !options.Stream)
+		{
+			timer.Reset();
+			scene.PerlinNoiseGenerator.GenerateFrame((frame + 1) * options.Animate / 60.0);
+			scene.UseGeneratedNoise();
+			animateNoiseTotal += timer.ElapsedMillis();
+
+			timer.Reset();
+			renderer.UpdateScene(scene);
+			animateSceneTotal += timer.ElapsedMillis();
+		}
+
+		// Moving the camera between frames times what flying through the scene costs
+		if (frame > 0 && options.CameraMove != glm::vec3(0.0f))
+			camera.SetPose(camera.GetPosition() + options.CameraMove, camera.GetDirection());
+
+		timer.Reset();
+		renderer.Render(scene, camera);
+		double frameTime = timer.ElapsedMillis();
+
+		renderTotal += frameTime;
+		renderMin = std::min(renderMin, frameTime);
+		renderMax = std::max(renderMax, frameTime);
+
+		// The first frame grows the thread pool's queues, later frames should not allocate
+		if (frame > 0)
+			renderAllocations = std::max(renderAllocations, renderer.GetFrameAllocations());
+	}
+	double renderAverage = renderTotal / options.Frames;
+	double rays = (double)options.ViewportWidth * (double)options.ViewportHeight;
+
+	if (!options.Load.empty())
+		std::printf("load_ms         %.3f\n", loadTime);
+	else
+		std::printf("noise_ms        %.3f\n", noiseTime);
+	std::printf("scene_ms        %.3f\n", sceneTime);
+	if (!options.Save.empty())
+		std::printf("save_ms         %.3f\n", saveTime);
+	std::printf("render_avg_ms   %.3f\n", renderAverage);
+	std::printf("render_min_ms   %.3f\n", renderMin);
+	std::printf("render_max_ms   %.3f\n", renderMax);
+	std::printf("rays_per_second %.0f\n", rays / (renderAverage / 1000.0));
+	std::printf("render_allocs   %llu\n", (unsigned long long)renderAllocations);
+	std::printf("pass_scale      %u\n", renderer.GetPassScale());
+	if (options.Animate > 0.0 && !options.Stream)
+	{
+		std::printf("frame_noise_ms  %.3f\n", animateNoiseTotal / options.Frames);
+		std::printf("frame_scene_ms  %.3f\n", animateSceneTotal / options.Frames);
+	}
+
+	if (!options.Output.empty())
+	{
+		if (!Utils::WritePPM(options.Output, renderer.GetColorBuffer(), renderer.GetWidth(), renderer.GetHeight()))
+		{
+			std::cerr << "Failed to write " << options.Output << '\n';
+			return 1;
+		}
+		std::cout << "Wrote " << options.Output << '\n';
+	}
+
+	return 0;
+}
@@ -8,3 +8,5 @@ outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 include "Walnut/WalnutExternal.lua"
 
 include "PerlinNoise"
+include "PerlinNoiseHeadless"
+include "PerlinNoiseBenchmark"